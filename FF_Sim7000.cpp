@@ -7,69 +7,286 @@
 
 #include <FF_Sim7000.h>
 #include <FF_Trace.h>
+#include <FF_Sim7000Trace.h>
 #include <time.h>
 #include <mktime.h>
 #ifdef ESP8266
     #include <NtpClientLib.h>
 #endif
 
-#include <pdulib.h>                                                 // https://github.com/mgaman/PDUlib
-
 struct initStepsStruct {
     void (FF_Sim7000::*nextStep)(void);
-    char command[20];
+    const char* command;
     char waitFor[10];
     unsigned long timeout;
     uint8_t repeat;
 };
 
-uint8_t stepPtr;                                                    // Pointer into initSteps table
-uint8_t stepRepeatCount;                                            // Count of repeat already done
-uint8_t stepMaxRepeatcount;                                         // Max repeat count for this command
-
 // Table containing init modem data (next step to run, data to send, data to wait for, timeout, repeat count)
-#define STEP_SIZE 14
-struct initStepsStruct initSteps[STEP_SIZE] = {
-    {nullptr,               "AT",                   "",             1000,                9}, // Begin, send AT (up to 10 times, 1s interval)
-    {nullptr,               "AT+IPR=115200",        "",             SIM7000_CMD_TIMEOUT, 0}, // Modem comm speed is 115200
-    {nullptr,               "ATE0",                 "",             SIM7000_CMD_TIMEOUT, 0}, // Echo off
-    {nullptr,               "AT+CMEE=2",            "",             SIM7000_CMD_TIMEOUT, 0}, // Return detailled error messages
-    {nullptr,               "AT+CMGF=0",            "",             SIM7000_CMD_TIMEOUT, 0}, // Set SMS mode = PDU (0)
-    {nullptr,               "AT+CNMP=51" ,           "",             SIM7000_CMD_TIMEOUT, 0}, // Prefered network mode = auto (2)
-    {nullptr,               "AT+CREG=2",            "",             SIM7000_CMD_TIMEOUT, 0}, // Verbose register network
-    {nullptr,               "AT+CSDH=1",            "",             SIM7000_CMD_TIMEOUT, 0}, // Show SMS headers
-    {nullptr,               "AT+CMGD=1,4",          "",             15000,               0}, // Delete all pending messages
-    {nullptr,               "AT+CNMI=2,2,0,2,0",    "",             SIM7000_CMD_TIMEOUT, 0}, // New messages indication
-    {nullptr,               "AT+CREG?",             "",             SIM7000_CMD_TIMEOUT, 0}, // Ask for network register status
-    {nullptr,               "AT+CLTS=1",            "",             SIM7000_CMD_TIMEOUT, 0}, // Ask for local time
+//  Commands may be grouped on one line, separated by ";". If modem returns an error, they're sent again one by one
+//      to find the failing one.
+const struct initStepsStruct initSteps[] = {
+    {&FF_Sim7000::probeModemSpeed, "",              "",             SIM7000_CMD_TIMEOUT, 0}, // Begin, send AT (looking for modem speed if autoBaud is set)
+    {&FF_Sim7000::setModemSpeed, "",                "",             SIM7000_CMD_TIMEOUT, 0}, // Set modem comm speed (AT+IPR), checking it if highSpeed is set
+    // Echo off, return numeric error codes (classified by classifySmsError()), set SMS mode = PDU (0), prefered network mode = auto (2), verbose register network, show SMS headers
+    {nullptr,               "ATE0;+CMEE=1;+CMGF=0;+CNMP=51;+CREG=2;+CSDH=1", "", SIM7000_CMD_TIMEOUT, 0},
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+    // Delete read and sent messages (unread ones will be drained), new messages indication (stored, +CMTI), save settings (for next warm start)
+    {nullptr,               "AT+CMGD=1,3;+CNMI=2,1,0,2,0;&W", "",  15000,               0},
+    #else
+    // Delete all pending messages, new messages indication, save settings (for next warm start)
+    {nullptr,               "AT+CMGD=1,4;+CNMI=2,2,0,2,0;&W", "",  15000,               0},
+    #endif
+    // Ask for network register status, ask for local time, read modem clock
+    {nullptr,               "AT+CREG?;+CLTS=1;+CCLK?", "",          SIM7000_CMD_TIMEOUT, 0},
     {nullptr,               "AT+CSCA?",             CSCA_INDICATOR, 15000,               0}, // Ask for CSA number
     {&FF_Sim7000::gotSca,   "",                     "",             SIM7000_CMD_TIMEOUT, 0}, // We got SCA number, save it for PDU
 };
+#define STEP_SIZE (sizeof(initSteps) / sizeof(initSteps[0]))
+
+// Table containing warm start steps (used when modem has already been initialized, see initSteps for format)
+const struct initStepsStruct warmSteps[] = {
+    {&FF_Sim7000::probeModemSpeed, "",              "",             SIM7000_CMD_TIMEOUT, 0}, // Begin, send AT (looking for modem speed if autoBaud is set)
+    {&FF_Sim7000::setModemSpeed, "",                "",             SIM7000_CMD_TIMEOUT, 0}, // Set modem comm speed if not the expected one
+    {nullptr,               "AT+CMEE?;+CMGF?;+CNMP?;+CSDH?;+CNMI?;+CSCA?", "", SIM7000_CMD_TIMEOUT, 0}, // Get config set by initSteps
+    {&FF_Sim7000::gotWarmState, "",                 "",             SIM7000_CMD_TIMEOUT, 0}, // Check config, run initSteps if changed
+    {nullptr,               "AT+CREG=2;+CREG?;+CLTS=1;+CCLK?", "",  SIM7000_CMD_TIMEOUT, 0}, // Verbose register network, ask for network register status and local time, read modem clock
+    {&FF_Sim7000::warmComplete, "",                 "",             SIM7000_CMD_TIMEOUT, 0}, // Load saved SCA number
+};
+#define WARM_STEP_SIZE (sizeof(warmSteps) / sizeof(warmSteps[0]))
+#define INIT_STEP_AFTER_SPEED 2                                     // First initSteps index after modem speed has been set
+
+// Speeds tried (after last used and begin() ones) when looking for modem speed
+const long probeSpeeds[] = {115200, 9600, 19200, 38400, 57600, 230400, 460800, 921600};
+#define PROBE_SPEED_COUNT (sizeof(probeSpeeds) / sizeof(probeSpeeds[0]))
+
+// Answers expected to warm start query when config is the one set by initSteps (+CSCA is checked separately)
+const char* const warmAnswers[] = {
+    "+CMEE: 1",
+    "+CMGF: 0",
+    "+CNMP: 51",
+    "+CSDH: 1",
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+    "+CNMI: 2,1,0,2,0",
+    #else
+    "+CNMI: 2,2,0,2,0",
+    #endif
+};
+#define WARM_ANSWER_COUNT (sizeof(warmAnswers) / sizeof(warmAnswers[0]))
+#define WARM_SCA_BIT (1 << WARM_ANSWER_COUNT)                       // Bit set in warmMatchMask when SCA is the saved one
+#define WARM_ALL ((WARM_SCA_BIT << 1) - 1)                          // All answers are matching
+
+// UTF-8 lead byte classification table
+//  High nibble: length of UTF-8 sequence starting with this byte (1 for ASCII and invalid lead bytes)
+//  Low nibble: GSM7 class (UTF8_NOT_GSM7, UTF8_GSM7, ..., see below)
+#define UTF8_NOT_GSM7 0                                             // Character is not in GSM7 table
+#define UTF8_GSM7 1                                                 // Character is coded on one GSM7 septet
+#define UTF8_GSM7_ESCAPE 2                                          // Character is coded on two GSM7 septets (escape + char)
+#define UTF8_CHECK_C2 3                                             // Check second byte against utf8C2Map
+#define UTF8_CHECK_C3 4                                             // Check second byte against utf8C3Map
+#define UTF8_CHECK_E2 5                                             // Check for euro sign (0xe2 0x82 0xac, coded on two septets)
+#define UTF8_GSM7_CLASS(x) ((x) & 0x0f)
+#define UTF8_SEQUENCE_LENGTH(x) ((x) >> 4)
+
+static const uint8_t utf8Class[256] = {
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x11, 0x10, 0x12, 0x11, 0x10, 0x10, // 0x00-0x0f (LF, FF, CR)
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, // 0x10-0x1f
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, // 0x20-0x2f (space to /)
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, // 0x30-0x3f (0 to ?)
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, // 0x40-0x4f (@ to O)
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x12, 0x12, 0x12, 0x11, // 0x50-0x5f (P to Z, [ to ^, _)
+    0x10, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, // 0x60-0x6f (`, a to o)
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x12, 0x12, 0x12, 0x10, // 0x70-0x7f (p to z, { to ~)
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, // 0x80-0x8f (continuation)
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, // 0x90-0x9f (continuation)
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, // 0xa0-0xaf (continuation)
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, // 0xb0-0xbf (continuation)
+    0x20, 0x20, 0x23, 0x24, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, // 0xc0-0xcf (2 bytes)
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, // 0xd0-0xdf (2 bytes)
+    0x30, 0x30, 0x35, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, // 0xe0-0xef (3 bytes)
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10  // 0xf0-0xff (4 bytes, invalid)
+};
+
+// Second byte (0x80-0xbf) bit maps of two bytes UTF-8 characters coded on one GSM7 septet (bit 0 of byte 0 is 0x80)
+static const uint8_t utf8C2Map[8] = {0x00, 0x00, 0x00, 0x00, 0xba, 0x00, 0x00, 0x80};  // ¡ £ ¤ ¥ § ¿
+static const uint8_t utf8C3Map[8] = {0xf0, 0x02, 0x42, 0x91, 0x71, 0x13, 0x46, 0x13};  // Ä Å Æ Ç É Ñ Ö Ø Ü ß à ä å æ è é ì ñ ò ö ø ù ü
+#define UTF8_IN_MAP(map, c) (((c) & 0xc0) == 0x80 && ((map)[((c) - 0x80) >> 3] & (1 << (((c) - 0x80) & 7))))
+
+// Table containing unsolicited messages (line prefix, prefix length, routine to call when line is complete)
+//  Routine returns false if line should be handled as any other answer
+struct urcStruct {
+    const char* prefix;
+    uint8_t length;
+    bool (FF_Sim7000::*handler)(void);
+};
 
-#define PDU_BUFFER_LENGTH 1024                                      // Max workspace length
-PDU smsPdu = PDU(PDU_BUFFER_LENGTH);                                // Instantiate PDU class
+const struct urcStruct urcTable[] = {
+    {CREG_MSG,          sizeof(CREG_MSG)-1,         &FF_Sim7000::gotCreg},          // Network registration status
+    {GSM_TIME,          sizeof(GSM_TIME)-1,         &FF_Sim7000::gotNetworkTime},   // Network time
+    {CCLK_INDICATOR,    sizeof(CCLK_INDICATOR)-1,   &FF_Sim7000::gotClock},         // Modem clock
+    {CSQ_INDICATOR,     sizeof(CSQ_INDICATOR)-1,    &FF_Sim7000::gotCsq},           // Signal quality (telemetry poll)
+    {CPSI_INDICATOR,    sizeof(CPSI_INDICATOR)-1,   &FF_Sim7000::gotCpsi},          // System information (telemetry poll)
+    {SMS_INDICATOR,     sizeof(SMS_INDICATOR)-1,    &FF_Sim7000::gotSmsIndicator},  // SMS header (PDU will follow)
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+    {SMS_STORED_INDICATOR, sizeof(SMS_STORED_INDICATOR)-1, &FF_Sim7000::gotSmsStored}, // SMS stored by modem
+    {SMS_LIST_INDICATOR, sizeof(SMS_LIST_INDICATOR)-1, &FF_Sim7000::gotSmsListHeader}, // Stored SMS header (PDU will follow)
+    #endif
+    {CMS_ERROR,         sizeof(CMS_ERROR)-1,        &FF_Sim7000::gotCmError},       // SMS error
+    {CME_ERROR,         sizeof(CME_ERROR)-1,        &FF_Sim7000::gotCmError},       // Equipment error
+};
+#define URC_COUNT (sizeof(urcTable) / sizeof(urcTable[0]))
+#define URC_ALL ((1 << URC_COUNT) - 1)                              // Bit mask with all URC entries set
 
-#ifdef FF_SIM7000_USE_SOFTSERIAL                                    // Define FF_SIM7000_USE_SOFTSERIAL to use SofwareSerial instead of Serial
-    #include <SoftwareSerial.h>
-    SoftwareSerial Sim7000Serial;                                   // We use software serial to keep Serial usable
+#ifdef FF_SIM7000_USE_SOFTSERIAL
     #warning Using SoftwareSerial may be unreliable at high speed!
 #else
     #if defined(FF_SIM7000_USE_SERIAL1)
-        #define Sim7000Serial Serial1                               // Use Serial1
+        #define SIM7000_DEFAULT_SERIAL Serial1                      // Use Serial1 if begin() doesn't give serial
     #elif defined(FF_SIM7000_USE_SERIAL2)
-        #define Sim7000Serial Serial2                               // Use Serial2
+        #define SIM7000_DEFAULT_SERIAL Serial2                      // Use Serial2 if begin() doesn't give serial
     #else
-        #define Sim7000Serial Serial                                // Use Serial for Sim7000lib
+        #define SIM7000_DEFAULT_SERIAL Serial                       // Use Serial if begin() doesn't give serial
+    #endif
+    #if defined(ESP8266) && (defined(FF_SIM7000_USE_SERIAL1) || defined(FF_SIM7000_USE_SERIAL2))
+        #error ESP8266 can only use Serial and SoftwareSerial, not SERIAL1 or Serial2!
     #endif
 #endif
 
+// Upper limit (ms) of each latency histogram bucket (last one gets all greater values)
+const uint32_t histogramLimits[SIM7000_HISTOGRAM_BUCKETS-1] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000};
+
+// Add a measure to an histogram
+static void histogramAdd(FF_Sim7000Histogram &histogram, uint32_t valueMs) {
+    uint8_t i = 0;
+    while (i < SIM7000_HISTOGRAM_BUCKETS-1 && valueMs >= histogramLimits[i]) {
+        i++;
+    }
+    histogram.bucket[i]++;
+    histogram.count++;
+    histogram.totalMs += valueMs;
+    if (valueMs > histogram.maxMs) {
+        histogram.maxMs = valueMs;
+    }
+}
+
+// Parts of verbose (AT+CMEE=2) CMS errors texts, used if error has no numeric code
+static const char* const smsFailTexts[] = {"number", "barr", "subscriber", "rejected", "invalid", "not supported", "not implemented"};
+static const char* const smsRestartTexts[] = {"SIM", "memory", "SMSC", "ME failure", "reserved", "not allowed"};
+
+// Return true if text contains one of given strings
+static bool containsOneOf(const char* text, const char* const strings[], uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (strstr(text, strings[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Classify a +CMS/+CME error received while sending an SMS chunk (3GPP TS 27.005 and 24.011 codes, as set by AT+CMEE=1)
+static uint8_t classifySmsError(const char* answer) {
+    if (strncmp(answer, CMS_ERROR, sizeof(CMS_ERROR)-1)) {
+        return SIM7000_SMS_ERROR_RESTART;                           // Equipment error
+    }
+    const char* ptrStr = answer + sizeof(CMS_ERROR) - 1;
+    while (*ptrStr == ':' || *ptrStr == ' ') {
+        ptrStr++;
+    }
+    char* end;
+    long code = strtol(ptrStr, &end, 10);
+    if (end == ptrStr) {                                            // Verbose error (AT+CMEE=2 set by application)
+        if (containsOneOf(ptrStr, smsRestartTexts, sizeof(smsRestartTexts) / sizeof(smsRestartTexts[0]))) {
+            return SIM7000_SMS_ERROR_RESTART;
+        }
+        if (containsOneOf(ptrStr, smsFailTexts, sizeof(smsFailTexts) / sizeof(smsFailTexts[0]))) {
+            return SIM7000_SMS_ERROR_FAIL;
+        }
+        return SIM7000_SMS_ERROR_RETRY;
+    }
+    if (code < 128) {                                               // Network (RP) causes
+        return (code == 38 || code == 41 || code == 42 || code == 47) ? SIM7000_SMS_ERROR_RETRY : SIM7000_SMS_ERROR_FAIL;
+    }
+    if (code < 256) {                                               // Service center (TP) causes: only busy/failure are transient
+        return (code == 192 || code == 194 || code == 212 || code == 255) ? SIM7000_SMS_ERROR_RETRY : SIM7000_SMS_ERROR_FAIL;
+    }
+    if (code == 303 || code == 304 || code == 305) {                // Operation not supported, invalid PDU or text parameter
+        return SIM7000_SMS_ERROR_FAIL;
+    }
+    if ((code >= 300 && code <= 302) || (code >= 310 && code <= 322) || code == 330) {
+        return SIM7000_SMS_ERROR_RESTART;                           // ME failure, SIM, memory or SMSC address problem
+    }
+    return SIM7000_SMS_ERROR_RETRY;                                 // No network service, network time-out, unknown error...
+}
+
+// Last received/sent SMS fields access (char arrays or String)
+#ifdef FF_SIM7000_USE_FIXED_BUFFERS
+    static void setField(char* field, size_t fieldSize, const char* value) {
+        strncpy(field, value, fieldSize-1);
+        field[fieldSize-1] = 0;
+    }
+    #define SET_FIELD(field, value) setField(field, sizeof(field), value)
+    #define CLEAR_FIELD(field) field[0] = 0
+    #define FIELD_STR(field) (field)
+#else
+    #define SET_FIELD(field, value) field = value
+    #define CLEAR_FIELD(field) field = ""
+    #define FIELD_STR(field) (field).c_str()
+#endif
+
+// Deferred event types (first string of eventQueue records)
+#define EVENT_SMS_RECEIVED "R"                                      // Received SMS, followed by PDU
+#define EVENT_SMS_SENT "S"                                          // Sent SMS, followed by number, date and message
+#define EVENT_LINE "L"                                              // Unknown line, followed by line
+#define EVENT_STATUS "T"                                            // Modem status change, followed by status and reason
+
+// readModem() return codes
+#define READ_EMPTY 0                                                // No more data to read
+#define READ_LINE 1                                                 // A line (or one character answer) has been handled
+#define READ_PAUSED 2                                               // Data still to be read, but time or size limit reached
+
 // Class constructor : init some variables
-FF_Sim7000::FF_Sim7000() {
+FF_Sim7000::FF_Sim7000() : smsPdu(SIM7000_PDU_BUFFER_LENGTH), smsTxPdu{SIM7000_PDU_BUFFER_LENGTH, SIM7000_PDU_BUFFER_LENGTH} {
+    #ifdef FF_SIM7000_USE_SOFTSERIAL
+        modemSerial = &softSerial;
+    #else
+        modemSerial = &SIM7000_DEFAULT_SERIAL;
+    #endif
+    stepTable = initSteps;
+    stepCount = STEP_SIZE;
+    stepPtr = 0;
+    groupSplit = false;
+    groupPart = 0;
+    recentLatency = 0;
+    warmStart = true;
+    autoBaud = false;
+    highSpeed = false;
+    currentSpeed = 0;
+    targetSpeed = 0;
+    probeIndex = 0;
+    probeCount = 0;
+    speedTestCount = 0;
+    speedTestHash = 0;
+    speedTestReference = 0;
+    probingSpeed = false;
+    highSpeedFailed = false;
+    adaptivePowerOn = false;
+    modemStatusPin = -1;
+    lastBootProbe = 0;
+    bootProbing = false;
+    memset(&warmState, 0, sizeof(warmState));
+    inWarmQuery = false;
+    warmMatchMask = 0;
+    #if defined(ESP32) && !defined(FF_SIM7000_USE_SOFTSERIAL)
+        taskHandle = NULL;
+    #endif
     restartNeeded = false;
     gsmStatus = SIM7000_NEED_INIT;
     restartReason = gsmStatus;
     smsReady = false;
-    inReceive = false;
+    cmdState = SIM7000_CMD_NONE;
+    cmdRetries = 0;
+    cmdQueueRead = 0;
+    cmdQueueCount = 0;
     gsmIdle = SIM7000_STARTING;
     debugFlag = false;
     traceFlag = false;
@@ -77,17 +294,32 @@ FF_Sim7000::FF_Sim7000() {
     firstInitDone = false;
     modemSpeaking = false;
     nextLineIsSmsMessage = false;
+    smsDuringCommand = false;
     commandCount = 0;
     resetCount = 0;
     smsReadCount = 0;
     smsForwardedCount = 0;
     smsSentCount = 0;
-    lastReceivedNumber = "";
-    lastReceivedDate = "";
-    lastReceivedMessage = "";
-    lastSentNumber = "";
-    lastSentDate = "";
-    lastSentMessage = "";
+    CLEAR_FIELD(lastReceivedNumber);
+    CLEAR_FIELD(lastReceivedDate);
+    CLEAR_FIELD(lastReceivedMessage);
+    CLEAR_FIELD(lastSentNumber);
+    CLEAR_FIELD(lastSentDate);
+    syncTime = 0;
+    syncMillis = 0;
+    lastSentTime = 0;
+    lastSentDateValid = true;
+    CLEAR_FIELD(lastSentMessage);
+    telemetryInterval = 0;
+    minMultipartCsq = 0;
+    inTelemetry = false;
+    regState = 0;
+    telemetryNext = 0;
+    telemetryCount = 0;
+    telemetryTotal = 0;
+    holdSampleCount = 0;
+    lastTelemetryTime = 0;
+    holdStartTime = 0;
     ignoreErrors = false;
     startTime = 0;
     restartCount = 0;
@@ -95,19 +327,73 @@ FF_Sim7000::FF_Sim7000() {
     readSmsCb = NULL;
     sendSmsCb = NULL;
     recvLineCb = NULL;
+    statusCb = NULL;
+    restartNotified = false;
+    modemReady = false;
+    #ifdef FF_SIM7000_CAPTURE
+        captureCb = NULL;
+        clearCapture();
+        captureDumped = false;
+    #endif
     index = 0;
     gsmTimeout = 0;
-    inWait = false;
-    inWaitSmsReady = false;
-    memset(lastAnswer, 0, sizeof(lastAnswer));
+    #if MAX_ANSWER > 0
+        lastAnswer = answerBuffer;
+        answerSize = sizeof(answerBuffer);
+        memset(lastAnswer, 0, answerSize);
+    #else
+        lastAnswer = NULL;                                          // Storage will be given by setAnswerBuffer()
+        answerSize = 0;
+    #endif
+    answerLen = 0;
+    rxPos = 0;
+    rxLen = 0;
+    rxNotified = false;
+    replayData = NULL;
+    replayLength = 0;
     memset(expectedAnswer, 0, sizeof(expectedAnswer));
+    expectedLength = 0;
+    isDefaultAnswer = false;
+    urcCandidates = URC_ALL;
+    urcMatch = URC_COUNT;
     memset(lastCommand, 0, sizeof(lastCommand));
     smsMsgId = 0;
+    txPduIndex = 0;
+    preparedLength = 0;
     powerStepDuration[0] = 1500;                                    // High for 1,5s (will reset)
     powerStepDuration[1] = 2000;                                    // Low for 2s (will give time for modem to switch off)
     powerStepDuration[2] = 1500;                                    // High for 1,5s (will reset)
     powerStepDuration[3] = 10000;                                   // Low for 10s (will give time for modem to switch on)
     powerStepDuration[4] = 0;                                       // End of table
+    smsQueue.begin(smsQueueBuffer, sizeof(smsQueueBuffer));
+    #if SIM7000_EVENT_QUEUE_SIZE > 0
+        eventQueue.begin(eventQueueBuffer, sizeof(eventQueueBuffer));
+    #else
+        eventQueue.begin(NULL, 0);                                  // No storage, deferCallbacks can't be used
+    #endif
+    deferCallbacks = false;
+    loopBudget = 0;
+    cleanupPolicy = SIM7000_CLEANUP_IMMEDIATE;
+    ackSms = false;
+    cleanupPending = false;
+    lastSmsTime = 0;
+    batchSend = false;
+    inBatch = false;
+    loopStartTime = 0;
+    resetMetrics();
+    #if SIM7000_REASSEMBLY_SLOTS > 0
+        memset(reassemblySlot, 0, sizeof(reassemblySlot));
+    #endif
+    commandClass = SIM7000_CLASS_OTHER;
+    chunkStartTime = 0;
+    messageStartTime = 0;
+    queueSending = false;
+    smsDone = false;
+    smsRestarted = false;
+    smsRetries = 0;
+    smsErrorClass = SIM7000_SMS_ERROR_RETRY;
+    smsNumber = NULL;
+    smsText = NULL;
 }
 
 /*!
@@ -126,6 +412,78 @@ void FF_Sim7000::setPowerPin(void) {
     powerStepStartTime = millis();
 }
 
+/*!
+
+    \brief  Set modem STATUS pin
+
+    When set, modem is considered booted as soon as this pin is at SIM7000_STATUS_ACTIVE level (with adaptivePowerOn).
+        Should be called before begin().
+
+    \param[in]  statusPin: ESP pin connected to modem STATUS pin (-1 if not connected)
+    \return none
+
+*/
+void FF_Sim7000::setStatusPin(int8_t statusPin) {
+    modemStatusPin = statusPin;
+    if (modemStatusPin >= 0) {
+        pinMode(modemStatusPin, INPUT);
+    }
+}
+
+/*!
+
+    \brief  [Private] Check if modem booted, during last power step (adaptive power on)
+
+    Serial is opened and AT sent every SIM7000_BOOT_PROBE_INTERVAL ms, starting at half of learned boot time.
+        Modem is booted when it sends anything (RDY, OK...) or when STATUS pin is active.
+
+    \param  none
+    \return true if modem booted
+
+*/
+bool FF_Sim7000::checkModemBoot(void) {
+    if (modemStatusPin >= 0 && digitalRead(modemStatusPin) == SIM7000_STATUS_ACTIVE) {
+        return true;
+    }
+    if ((millis() - powerStepStartTime) < warmState.bootTime / 2) {
+        return false;                                               // Too early
+    }
+    if (!bootProbing) {
+        if (!currentSpeed) {
+            currentSpeed = modemSpeed;
+        }
+        openModem(currentSpeed);
+        bootProbing = true;
+        lastBootProbe = millis() - SIM7000_BOOT_PROBE_INTERVAL;
+    }
+    if (modemSerial->available()) {
+        return true;
+    }
+    if ((millis() - lastBootProbe) >= SIM7000_BOOT_PROBE_INTERVAL) {
+        lastBootProbe = millis();
+        writeModem("AT\r");
+    }
+    return false;
+}
+
+/*!
+
+    \brief  [Private] End of power steps: release power key and start modem init
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::endPowerSteps(void) {
+    // Last step, clear step begin time
+    powerStepStartTime = 0;
+    bootProbing = false;
+    // Release power key
+    pinMode(modemPowerPin, OUTPUT_OPEN_DRAIN);
+    // Open Serial modem port
+    open();
+}
+
 /*!
 
     \brief  Initialize the GSM connection
@@ -140,11 +498,37 @@ void FF_Sim7000::setPowerPin(void) {
 
 */
 void FF_Sim7000::begin(long baudRate, int8_t rxPin, int8_t txPin, int8_t powerPin) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     trace_debug_P("Sim7000 begin", NULL);
+    #if MAX_ANSWER == 0
+        if (!lastAnswer) {
+            trace_error_P("No answer storage, setAnswerBuffer() should be called before begin()", NULL);
+            return;
+        }
+    #endif
+    #if SIM7000_EVENT_QUEUE_SIZE == 0
+        if (deferCallbacks) {
+            trace_error_P("deferCallbacks needs SIM7000_EVENT_QUEUE_SIZE > 0, ignoring it", NULL);
+            deferCallbacks = false;
+        }
+    #endif
+    if (queueSending) {                                             // Restarted while sending a queued SMS
+        releaseQueuedSms(true);
+    }
     restartNeeded = false;
-    inReceive = false;
-    inWait = false;
+    restartNotified = false;
+    modemReady = false;
+    #ifdef FF_SIM7000_CAPTURE
+        captureDumped = false;
+    #endif
+    cmdState = SIM7000_CMD_NONE;
+    cmdQueueCount = 0;                                              // Forget commands queued before restart
+    inBatch = false;
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+        smsStored = true;                                           // Read messages received while modem was down
+        inDrain = false;
+        lastDrainTime = millis();
+    #endif
     gsmIdle = SIM7000_STARTING;
     // Save RX pin, TX pin and requested speed
     modemRxPin = rxPin;
@@ -174,6 +558,26 @@ void FF_Sim7000::begin(long baudRate, int8_t rxPin, int8_t txPin, int8_t powerPi
     modemSpeaking = false;
 }
 
+/*!
+
+    \brief  Initialize GSM connection on a given serial
+
+    Same as begin(baudRate, rxPin, txPin, powerPin), using given serial instead of default one.
+        This allows using multiple modems, each one on its own serial.
+
+    \param[in]  serial: serial connected to modem (Serial1, Serial2...)
+    \param[in]  baudRate: modem speed (in bauds). Modem will be properly switched to this speed if needed
+    \param[in]  rxPin: ESP pin used to receive data from modem (connected to Sim7000 TX)
+    \param[in]  txPin: ESP pin used to send data to modem (connected to Sim7000 RX)
+    \param[in]  powerPin: ESP pin used to power up/down modem (connected to Sim7000 power key)
+    \return none
+
+*/
+void FF_Sim7000::begin(SIM7000_SERIAL_CLASS& serial, long baudRate, int8_t rxPin, int8_t txPin, int8_t powerPin) {
+    modemSerial = &serial;
+    begin(baudRate, rxPin, txPin, powerPin);
+}
+
 /*!
 
     \brief  Open GSM serial
@@ -185,504 +589,1829 @@ void FF_Sim7000::begin(long baudRate, int8_t rxPin, int8_t txPin, int8_t powerPi
 */
 
 void FF_Sim7000::open() {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     trace_debug_P("Opening modem", NULL);
-    // Open modem at requested speed initially
-    openModem(modemSpeed);
+    // Open modem at last used speed (requested one initially)
+    if (!currentSpeed) {
+        currentSpeed = modemSpeed;
+    }
+    openModem(currentSpeed);
+    // Use warm start if modem has already been initialized
+    if (warmStart && warmState.magic == SIM7000_WARM_MAGIC) {
+        trace_info_P("Warm start", NULL);
+        warmState.magic = 0;                                        // Will be set again if warm start succeeds
+        stepTable = warmSteps;
+        stepCount = WARM_STEP_SIZE;
+        inWarmQuery = true;
+        warmMatchMask = 0;
+    } else {
+        stepTable = initSteps;
+        stepCount = STEP_SIZE;
+        inWarmQuery = false;
+    }
     // Init pointer and start modem init process
+    groupSplit = false;
+    probeIndex = 0;
+    probeCount = 0;
     stepPtr = 0;
-    stepMaxRepeatcount = 0;
-    stepRepeatCount = 0;
     sendCurrentInitStep();
 }
 
 /*!
 
-    \brief  Modem loop (should be called in main loop)
+    \brief  Use an application supplied storage for modem answers
 
-    This routine should be called at regular interval in order for the modem code to run (as we're asynchronous)
+    Default storage is MAX_ANSWER long, which may be shrunk by tiny builds or raised by gateways
+        (a received PDU may be more than 350 characters long). Define MAX_ANSWER as 0 to remove default storage
+        when this routine is always used.
+        This routine should be called before begin(), storage should remain allocated while class is used.
 
-    \param  none
+    \param[in]  buffer: storage area
+    \param[in]  size: storage area size (in bytes)
     \return none
 
 */
-void FF_Sim7000::doLoop(void) {
-    if (traceFlag) enterRoutine(__func__);
-    // Are we in modem power steps?
-    if (powerStepStartTime) {
-        // Is current step finished
-        if ((millis() - powerStepStartTime) >= powerStepDuration[powerStep]) {
-            // Set power pin level
-            powerStep++;
-            setPowerPin();
-            // Is this the last power step?
-            if (!powerStepDuration[powerStep]) {
-                // Last step, clear step begin time
-                powerStepStartTime = 0;
-                // Release power key
-                pinMode(modemPowerPin, OUTPUT_OPEN_DRAIN);
-                // Open Serial modem port
-                open();
-            }
-        }
-    } else {
-        // Read modem until \n (LF) character found, removing \r (CR)
-            size_t answerLen = strlen(lastAnswer);                  // Get answer length
-            while (Sim7000Serial.available()) {
-                // Flag modem speaking
-                modemSpeaking = true;
-                char c = Sim7000Serial.read();
-                // Skip NULL and CR characters
-                if (c != 0 && c != 13) {
-                    if (answerLen >= sizeof(lastAnswer)-2) {
-                        trace_error_P("Answer too long: >%s<", lastAnswer);
-                        // Answer is too long
-                        gsmStatus = SIM7000_TOO_LONG;
-                        resetLastAnswer();
-                        return;
-                    }
-                    // Do we have an answer?
-                    if (c == 10) {
-                        #ifdef FF_SIM7000_DUMP_MESSAGE_ON_SERIAL
-                            Serial.print("<LF>");
-                        #endif
-                        // Do we have an "CREG" message or answer?
-                        char *ptrStr = strstr(lastAnswer, CREG_MSG);
-                        if (ptrStr) {
-                            // Do we just sent a CREG request?
-                            if (strstr(lastCommand, CREG_QUERY)) {
-                                // We asked for CREG, there's a single char plus a comma to skip
-                                ptrStr += sizeof(CREG_MSG)+1;
-                            } else {
-                                // This is an unsolicited CREG, skip only message length (except ending \0)
-                                ptrStr += sizeof(CREG_MSG)-1;
-                            }
-                            // Extract number after CREG_MSG
-                            char result = ptrStr[0];
-                            if (debugFlag) trace_debug_P("Got %s, state: %c", lastAnswer, result);
-                            smsReady = (result == '1' || result == '5');
-                            resetLastAnswer();
-                            return;
-                        }
-                        // Do we have a time message?
-                        #ifdef FF_SIM6000_SET_TIME_FROM_GSM_NETWORK
-                        ptrStr = strstr(lastAnswer, GSM_TIME);
-                        if (ptrStr) {
-                            // Format in doc: *PSUTTZ: <year>,<month>,<day>,<hour>,<min>,<sec>,"<timezone>",<dst>
-                            // Message received: *PSUTTZ: 25/04/02,09:49:27","+08",1
-                            // As you can see, formats are not really the same...
-                            // We'll try to adapt to some kind of "artistic" format, loading only useful characters
-                            // Extract date part
-                            char currentDate[35];
-                            memset(currentDate, 0, sizeof(currentDate));
-                            uint8_t outPtr = 0;
-                            // Skip GSM_TIME marker
-                            ptrStr += sizeof(GSM_TIME) -1 ;
-                            char c = ptrStr[0];
-                            // Run until end of string
-                            bool scanOk = true;
-                            while (c && scanOk) {
-                                //  Replace / and : by ,
-                                if (c == '/' || c == ':') {
-                                    currentDate[outPtr++] = ',';
-                                //  Store 0 to 9, + , - and ,
-                                } else if ((c >= '0' && c <= '9') || c == '+' || c == '-' || c == ',') {
-                                    currentDate[outPtr++] = c;
-                                // Skip "
-                                } else if (c != '"') {
-                                    // Reject illegal characters
-                                    if (debugFlag) trace_debug_P("Illegal character 0x%x found in %s", c, lastAnswer);
-                                    scanOk = false;
-                                }
-                                // Next char in answer
-                                ptrStr++;
-                                c = ptrStr[0];
-                                // Exit loop if currentDate overflow
-                                if (outPtr >= sizeof(currentDate)) {
-                                    if (debugFlag) trace_debug_P("Answer %s is too long (%d-%s)", lastAnswer, outPtr, currentDate);
-                                    scanOk = false;
-                                }
-                            }
-                            // If returned data is ok
-                            if (scanOk) {
-                                // Now, message should looks like 25,04,02,09,49,27,+08,1
-                                // We should extract 8 values (year, month, day, hour, minute, second, quarters to GMT, DST flag)
-                                #define TOKEN_COUNT 8
-                                int values[TOKEN_COUNT];
-                                #define TM_YEAR 0
-                                #define TM_MONTH 1
-                                #define TM_DAY 2
-                                #define TM_HOUR 3
-                                #define TM_MIN 4
-                                #define TM_SEC 5
-                                #define TM_QUARTERS_TO_UTC 6
-                                #define TM_IS_DST 7
-                                // Extract first token
-                                char *token = strtok (currentDate, ",");
-                                // Scan the 8 tokens
-                                for (int i = 0; i < TOKEN_COUNT; i++) {
-                                    // If extraction is still ok
-                                    if (scanOk) {
-                                        // Do we have a token?
-                                        if (token != NULL) {
-                                            values[i] = atoi(token);
-                                            token = strtok(NULL, ",");
-                                        } else {
-                                            // No more token, give error
-                                            if (debugFlag) trace_debug_P("Token %d not found", i);
-                                            scanOk = 0;
-                                        }
-                                    }
-                                }
-                                // Still ok?
-                                if (scanOk) {
-                                    // Set time
-									uint32_t unixTime = (long) unixTimeInSeconds(values[TM_SEC], values[TM_MIN], values[TM_HOUR], values[TM_DAY], values[TM_MONTH], values[TM_YEAR] + 2000);
-									timeval epoch = {(long) unixTime, 0};
-									if (debugFlag) {
-										tm timeinfo;
-										getLocalTime(&timeinfo, 250);
-										char dateBefore[25];
-										strftime(dateBefore, sizeof(dateBefore), "%Y/%m/%d %H:%M:%S", &timeinfo);
-										settimeofday((const timeval*)&epoch, 0);
-										getLocalTime(&timeinfo, 250);
-										char dateAfter[25];
-										strftime(dateAfter, sizeof(dateAfter), "%Y/%m/%d %H:%M:%S", &timeinfo);
-										trace_debug_P("Date changed from %s to %s", dateBefore, dateAfter);
-
-									} else {
-										settimeofday((const timeval*)&epoch, 0);
-									}
-                                    resetLastAnswer();
-                                    return;
-                                }
-                            }
-                            resetLastAnswer();
-                        }
-                        #endif
-                        if (inReceive) {                            // Are we waiting for a command answer?
-                            // Is this the expected answer?
-                            bool isDefaultAnwer = !(strcmp(expectedAnswer, DEFAULT_ANSWER));
-                            if ((isDefaultAnwer && !strcmp(lastAnswer, expectedAnswer)) || (!isDefaultAnwer && strstr(lastAnswer, expectedAnswer))) {
-                                if (debugFlag) trace_debug_P("Reply in %d ms: >%s<", millis() - startTime, lastAnswer);
-                                gsmStatus = SIM7000_OK;
-                                if (nextStepCb) {                   // Do we have another callback to execute?
-                                    (this->*nextStepCb)();          // Yes, do it
-                                return;
-                            }
-                                    setIdle();                      // No, we just finished.
-                                return;
-                            }
-                            if (!ignoreErrors) {                    // Should we ignore errors?
-                                // No, check for CMS/CME error
-                                if (strstr(lastAnswer,"+CMS ERROR") || strstr(lastAnswer,"+CME ERROR")) {
-                                    // This is a CMS or CME answer
-                                    trace_error_P("Error answer: >%s< after %d ms, command was %s", lastAnswer, millis() - startTime, lastCommand);
-                                    gsmStatus = SIM7000_CM_ERROR;
-                                    restartNeeded = true;
-                                    restartReason = gsmStatus;
-                                    setIdle();
-                                    return;
-                                }
-                            }
-                        }
-                        if (strlen(lastAnswer)) {                   // Answer is not null
-                            if (nextLineIsSmsMessage) {             // Are we receiving a SMS message?
-                                if (debugFlag) trace_debug_P("Message is >%s<", lastAnswer);    // Display cleaned message
-                                readSmsMessage(lastAnswer);         // Yes, read it
-                                resetLastAnswer();
-                                nextLineIsSmsMessage = false;       // Clear flag
-                                return;
-                            } else {                                // Not in SMS reception
-                                if (strstr(lastAnswer, SMS_INDICATOR)) {// Is this indicating an SMS reception?
-                                    if (debugFlag) trace_debug_P("Indicator is >%s<", lastAnswer);  // Display cleaned message
-                                    // Load last command with indicator
-                                    strncpy(lastCommand, lastAnswer, sizeof(lastCommand));
-                                    readSmsHeader(lastAnswer);
-                                    resetLastAnswer();
-                                    inReceive = true;
-                                    gsmTimeout = 2000;
-                                    startTime = millis();
-                                    return;
-                                } else {                            // Can't understand received data
-                                    if (debugFlag) trace_debug_P("Ignoring >%s<", lastAnswer);  // Display cleaned message
-                                    if (recvLineCb) (*recvLineCb)(lastAnswer);  // Activate callback with answer
-                                    resetLastAnswer();
-                                    return;
-                                }
-                            }
-                        }
-                    } else {
-                        // Add received character to lastAnswer
-                        #ifdef FF_SIM7000_DUMP_MESSAGE_ON_SERIAL
-                            Serial.print(c);
-                        #endif
-                        lastAnswer[answerLen++] = c;                // Copy character
-                        lastAnswer[answerLen] = 0;                  // Just in case we forgot cleaning buffer
-                        // Check for one character answer (like '>' when sending SMS) which have no <CR><LF>
-                        if (strlen(expectedAnswer) == 1 && c == expectedAnswer[0]) {
-                            if (debugFlag) trace_debug_P("Reply in %d ms: >%s<", millis() - startTime, lastAnswer);
-                            gsmStatus = SIM7000_OK;
-                            if (nextStepCb) {                       // Do we have another callback to execute?
-                                (this->*nextStepCb)();              // Yes, do it
-                            return;
-                        }
-                                setIdle();                          // No, we just finished.
-                            return;
-                        }
-                    }
-                #ifdef FF_SIM7000_DUMP_MESSAGE_ON_SERIAL
-                } else {
-                    if (c == 0) {
-                        Serial.print("<NULL>");
-                    } else if (c == 13 ) {
-                        Serial.print("<CR>");
-                    }
-                #endif
-                }
-            }
+void FF_Sim7000::setAnswerBuffer(char* buffer, size_t size) {
+    lastAnswer = buffer;
+    answerSize = size;
+    resetLastAnswer();
+}
 
-        if (inReceive) {                                            // We're waiting for a command answer
-            if ((millis() - startTime) >= gsmTimeout) {
-                if (ignoreErrors) {                                 // If errors should be ignored, call next step, if any
-                    trace_error_P("Ignoring time out after %d ms, received >%s<, command was %s", millis() - startTime, lastAnswer, lastCommand);
-                    if (nextStepCb) {                               // Do we have another callback to execute?
-                        (this->*nextStepCb)();                      // Yes, do it
-                        return;
-                    }
-                    setIdle();                                      // No, we just finished.
-                    return;
-                }
-                // Here, we've got a time-out on answer. Should we repeat command?
-                if (stepRepeatCount < stepMaxRepeatcount) {
-                    // We can repeat the request, do it
-                    stepRepeatCount++;                              // Increment repeat count
-                    sendCurrentInitStep();                          // Resebd the same command
-                    return;
-                }
-                if (lastAnswer[0]) {
-                    trace_error_P("Partial answer: >%s< after %d ms, command was %s", lastAnswer, millis() - startTime, lastCommand);
-                    gsmStatus = SIM7000_BAD_ANSWER;
-                    restartNeeded = true;
-                    restartReason = gsmStatus;
-                    setIdle();
-                    return;
-                } else {                                            // Time-out without any anwser
-                    trace_error_P("Timed out after %d ms, received >%s<, command was %s", millis() - startTime, lastAnswer, lastCommand);
-                    gsmStatus = SIM7000_TIMEOUT;
-                    restartNeeded = true;
-                    restartReason = gsmStatus;
-                    setIdle();
-                    return;
-                }
-            }
-        }
+#if defined(ESP32) && !defined(FF_SIM7000_USE_SOFTSERIAL)
+/*!
 
-        if (inWaitSmsReady && smsReady) {
-            if (debugFlag) trace_debug_P("End of %d ms SMS ready wait, received >%s<", millis() - startTime, lastAnswer);
-            inWait = false;
-            inWaitSmsReady = false;
-            gsmStatus = SIM7000_OK;
-            if (nextStepCb) {                                       // Do we have another callback to execute?
-                (this->*nextStepCb)();                              // Yes, do it
-                return;
-            }
-                setIdle();                                          // No, we just finished.
-            return;
-        }
+    \brief  Run modem in its own task (ESP32 only)
 
-        if (inWait) {
-            if ((millis() - startTime) >= gsmTimeout) {
-                if (debugFlag) trace_debug_P("End of %d ms wait, received >%s<", millis() - startTime, lastAnswer);
-                inWait = false;
-                gsmStatus = SIM7000_OK;
-                if (nextStepCb) {                                   // Do we have another callback to execute?
-                    (this->*nextStepCb)();                          // Yes, do it
-                    return;
-                }
-                    setIdle();                                      // No, we just finished.
-                return;
-            }
-        }
+    Should be called after begin(). Modem task then runs doLoop() each time modem sends data, an SMS is queued,
+        or when getNextDeadline() is reached (at least every SIM7000_TASK_TICK ms), and restarts modem when needed.
+
+    Application should then no longer call doLoop() nor begin(). Callbacks are deferred:
+        application should call dispatchEvents() to get them called in its own task.
+
+    \param[in]  core: core to pin modem task on
+    \param[in]  stackSize: modem task stack size (bytes)
+    \param[in]  priority: modem task priority
+    \return true if task has been started
+
+*/
+bool FF_Sim7000::startTask(BaseType_t core, uint32_t stackSize, UBaseType_t priority) {
+    SIM7000_ENTER_ROUTINE();
+    if (taskHandle) {
+        return true;                                                // Already started
     }
+    #if SIM7000_EVENT_QUEUE_SIZE == 0
+        trace_error_P("Modem task needs SIM7000_EVENT_QUEUE_SIZE > 0", NULL);
+        return false;
+    #endif
+    deferCallbacks = true;
+    if (xTaskCreatePinnedToCore(&FF_Sim7000::taskEntry, "Sim7000", stackSize, this, priority, &taskHandle, core) != pdPASS) {
+        trace_error_P("Can't start modem task", NULL);
+        taskHandle = NULL;
+        return false;
+    }
+    // Wake task up as soon as modem sends data
+    modemSerial->onReceive([this]() {notifyRxData(); xTaskNotifyGive(taskHandle);});
+    return true;
 }
 
 /*!
 
-    \brief  Trace some internal variables values (user for debug)
-
-    This routine dumps (almost all) variables using trace_info_P macro (usually defined in Ff_TRACE)
+    \brief  [Private] Modem task entry point
 
-    \param  none
-    \return none
+    \param[in]  parameter: modem class instance
+    \return none (never returns)
 
 */
-void FF_Sim7000::debugState(void) {
-    if (traceFlag) enterRoutine(__func__);
-    trace_info_P("lastCommand=%s", lastCommand);
-    trace_info_P("expectedAnswer=%s", expectedAnswer);
-    trace_info_P("lastAnswer=%s", lastAnswer);
-    trace_info_P("restartNeeded=%d", restartNeeded);
-    trace_info_P("restartReason=%d", restartReason);
-    trace_info_P("smsReady=%d", smsReady);
-    trace_info_P("gsmIdle=%d", gsmIdle);
-    trace_info_P("inReceive=%d", inReceive);
-    trace_info_P("gsmTimeout=%d", gsmTimeout);
-    trace_info_P("gsmStatus=%d", gsmStatus);
-    trace_info_P("index=%d", index);
-    trace_info_P("powerStep=%d", powerStep);
-    trace_info_P("startTime=%d", millis()-startTime);
-    if (powerStepStartTime) {
-        trace_info_P("powerStepStartTime=%d", millis()-powerStepStartTime);
-    }
-    trace_info_P("firstInitDone=%d", firstInitDone);
-    trace_info_P("modemSpeaking=%d", modemSpeaking);
-    trace_info_P("resetCount=%d", resetCount);
-    trace_info_P("restartCount=%d", restartCount);
-    trace_info_P("commandCount=%d", commandCount);
-    trace_info_P("smsReadCount=%d", smsReadCount);
-    trace_info_P("smsForwardedCount=%d", smsForwardedCount);
-    trace_info_P("smsSentCount=%d", smsSentCount);
-    trace_info_P("Sim7000-debugFlag=%d", debugFlag);
-    trace_info_P("Sim7000-traceFlag=%d", traceFlag);
-    trace_info_P("Sim7000-traceEnterFlag=%d", traceEnterFlag);
+void FF_Sim7000::taskEntry(void* parameter) {
+    ((FF_Sim7000*) parameter)->taskLoop();
 }
 
 /*!
 
-    \brief  Sends an SMS to modem
-
-    This routine pushes an SMS to modem.
-        It determines if message is a GMS7 only message or not (in this case, this will be UCS-2)
-        If message is GSM7, max length of non chunked SMS is 160. For UCS-2, this is 70.
-        When message is longer than these limits, it'll be split in chunks of 153 chars for GSM7, or 67 chars for UCS-2.
-        There's a theoretical limit of 255 chunks, but most of operators are limiting in lower size.
-        It seems that 7 to 8 messages are accepted by almost everyone, meaning 1200 GSM7 chars, or 550 UCS-2 chars.
+    \brief  [Private] Modem task loop
 
-    \param[in]  number: phone number to send message to
-    \param[in]  text: message to send
-    \return none
+    \param  none
+    \return none (never returns)
 
 */
-void FF_Sim7000::sendSMS(const char* number, const char* text) {
-    uint16_t utf8Length = strlen(text);                             // Size of UTF-8 message
-    uint8_t lengthToAdd;                                            // Length of one UTF-8 char in GSM-7 (or zero if UTF-8 input character outside GSM7 table)
-    uint8_t c1;                                                     // First char of UTF-8 message
-    uint8_t c2;                                                     // Second char of UTF-8 message
-    uint8_t c3;                                                     // Third char of UTF-8 message
-    gsm7Length = 0;                                                 // Size of GSM-7 message
-
-    for (uint16_t i = 0; i < utf8Length; i++) {                     // Scan the full message
-        c1 = text[i];                                               // Extract first to third chars
-        if (i+1 < utf8Length) {c2 = text[i+1];} else {c2 = 0;}
-        if (i+2 < utf8Length) {c3 = text[i+2];} else {c3 = 0;}
-        lengthToAdd = getGsm7EquivalentLen(c1, c2, c3);             // Get equivalent GSM-7 length
-        if (lengthToAdd) {                                          // If char is GSM-7
-            gsm7Length += lengthToAdd;                              // Add length
-        } else {
-            if (debugFlag) trace_info_P("Switched to UTF-8 on char %d (0x%02x) at pos %d", c1, c1, i);
-            gsm7Length = 0;                                         // Set length to zero
-            break;                                                  // Exit loop
+void FF_Sim7000::taskLoop(void) {
+    for (;;) {
+        if (restartNeeded) {
+            trace_warn_P("Restarting modem, reason %d", restartReason);
+            begin(modemSpeed, modemRxPin, modemTxPin, modemPowerPin);
         }
-    }
-
-    // Should we split message in chunks?
-    if (gsm7Length) {                                               // Is this a GSM-7 message ?
-        if (gsm7Length > 160) {                                     // This is a multi-part message
-            smsMsgCount = (gsm7Length + 151) / 152;                 // Compute total chunks
-            smsMsgId++;
-            smsChunkSize = 152;
+        doLoop();
+        // Sleep until modem data, queued SMS or next deadline
+        unsigned long sleepTime = getNextDeadline();
+        if (restartNeeded) {
+            sleepTime = 0;
+        }
+        if (sleepTime) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleepTime < SIM7000_TASK_TICK ? sleepTime : SIM7000_TASK_TICK));
         } else {
-            smsMsgCount = 0;
+            taskYIELD();
         }
-        if (debugFlag) trace_info_P("gsm7, lenght=%d, msgs=%d", gsm7Length, smsMsgCount);
-    } else {                                                        // This is an UCS-2 message
-    uint16_t ucs2Length = ucs2MessageLength(text);                  // Get UCS-2 message length
-    if (ucs2Length > 70) {                                          // This is a multi-part message
-        smsMsgCount = (ucs2Length + 66) / 67;                       // Compute total chunks
-        smsMsgId++;
-        smsChunkSize = 67;
-    } else {
-        smsMsgCount = 0;
-    }
-    if (debugFlag) trace_info_P("ucs2, length=%d, msgs=%d", ucs2Length, smsMsgCount);
-    }
-    // Save last used number and message
-    lastSentNumber = String(number);
-    lastSentMessage = String(text);
-
-    // Get local time
-    struct tm timeinfo;
-    getLocalTime(&timeinfo, 250);
-    char dateStr[25];
-    strftime(dateStr, sizeof(dateStr), "%Y/%m/%d %H:%M:%S", &timeinfo);
-    lastSentDate = String(dateStr);
-
-    // Send first (or only) SMS part
-    if (smsMsgCount == 0) {
-        sendOneSmsChunk(number, text);
-    } else {
-        smsMsgIndex = 0;
-        uint16_t startPos = smsMsgIndex++ * smsChunkSize;
-        sendOneSmsChunk(number, lastSentMessage.substring(startPos, startPos+smsChunkSize).c_str(), smsMsgId, smsMsgCount, smsMsgIndex);    // Send first chunk
     }
 }
+#endif
 
 /*!
 
-    \brief  Sends next SMS chunk to modem
+    \brief  Return state saved by last successful modem init
 
-    This routine is called when an SMS chunk has been pushed to modem, to send next part, if it exists
+    Application may save it (in RTC memory, NVS...) to restore it with setWarmState() after a reboot.
 
     \param  none
-    \return none
+    \return saved state (magic is SIM7000_WARM_MAGIC if valid)
 
 */
-void FF_Sim7000::sendNextSmsChunk(void){
-    if (smsMsgCount) {                                              // Are we in multi-part message ?
-        if (smsMsgIndex < smsMsgCount) {                            // Do we have more chunks to send ?
-            uint16_t startPos = smsMsgIndex++ * smsChunkSize;
-            sendOneSmsChunk(lastSentNumber.c_str(), lastSentMessage.substring(startPos, startPos+smsChunkSize).c_str(), smsMsgId, smsMsgCount, smsMsgIndex);    // Send first chunk
-            return;
-        }
-    }
-    setIdle();                                                      // Message has fully be sent
+const FF_Sim7000WarmState& FF_Sim7000::getWarmState(void) {
+    return warmState;
 }
 
 /*!
 
-    \brief  Sends an SMS chunk to modem
+    \brief  Restore state saved by a previous successful modem init
 
-    This routine pushes an SMS chunk to modem
+    Should be called before begin(). Next init will then be a warm one, if warmStart is set and state is valid.
 
-    \param[in]  number: phone number to send message to
-    \param[in]  text: message to send
-    \param[in]  msgId: SMS message identifier (should be incremented for each multi-part message, zero if not multi-part message)
-    \param[in]  msgCount: total number of SMS chunks (zero if not multi-part message)
-    \param[in]  msgIndex: index of this message chunk (zero if not multi-part message)
+    \param[in]  state: state previously returned by getWarmState()
     \return none
 
 */
-void FF_Sim7000::sendOneSmsChunk(const char* number, const char* text, const unsigned short msgId, const unsigned char msgCount, const unsigned char msgIndex) {
-    if (traceFlag) enterRoutine(__func__);
-    char tempBuffer[50];
-    int len = smsPdu.encodePDU(number, text, msgId, msgCount, msgIndex);
-    if (len < 0)  {
-            // -1: OBSOLETE_ERROR
-            // -2: UCS2_TOO_LONG
-            // -3 GSM7_TOO_LONG
-            // -4 MULTIPART_NUMBERS
+void FF_Sim7000::setWarmState(const FF_Sim7000WarmState& state) {
+    warmState = state;
+    warmState.scaNumber[sizeof(warmState.scaNumber)-1] = 0;
+}
+
+/*!
+
+    \brief  Modem loop (should be called in main loop)
+
+    This routine should be called at regular interval in order for the modem code to run (as we're asynchronous)
+
+    If loopBudget is zero, at most one line is handled per call. Else, lines are handled until loopBudget microseconds
+        are elapsed, remaining data being analyzed at next call.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::doLoop(void) {
+    SIM7000_ENTER_ROUTINE();
+    #if MAX_ANSWER == 0
+        if (!lastAnswer) {                                          // No answer storage, begin() refused to start
+            return;
+        }
+    #endif
+    loopStartTime = micros();
+    rxNotified = false;
+    runLoop();
+    if (restartNeeded && !restartNotified) {                        // Tell application once that modem should be restarted
+        restartNotified = true;
+        notifyStatus(modemReady ? SIM7000_STATUS_RESTART : SIM7000_STATUS_INIT_FAILED, restartReason);
+    }
+    #ifdef FF_SIM7000_CAPTURE
+        if (restartNeeded && !captureDumped) {                      // Give data which led to restart
+            captureDumped = true;
+            dumpCapture();
+        }
+    #endif
+    // Update loop metrics
+    uint32_t loopTime = micros() - loopStartTime;
+    metrics.loopCount++;
+    metrics.loopTotalUs += loopTime;
+    if (loopTime > metrics.loopMaxUs) {
+        metrics.loopMaxUs = loopTime;
+    }
+}
+
+// Keep earliest deadline, given a start time and a duration
+static void keepEarliest(unsigned long &deadline, unsigned long start, unsigned long duration) {
+    unsigned long elapsed = millis() - start;
+    unsigned long remaining = (elapsed >= duration) ? 0 : duration - elapsed;
+    if (remaining < deadline) {
+        deadline = remaining;
+    }
+}
+
+/*!
+
+    \brief  Return time before doLoop() should be called again
+
+    Application may sleep during this time, unless modem sends data (which may be signaled by notifyRxData()).
+
+    \param  none
+    \return time before next deadline (ms, 0 if doLoop() should be called now, SIM7000_NO_DEADLINE if only modem data can wake state machine up)
+
+*/
+unsigned long FF_Sim7000::getNextDeadline(void) {
+    unsigned long deadline = SIM7000_NO_DEADLINE;
+    // Modem power steps
+    if (powerStepStartTime) {
+        keepEarliest(deadline, powerStepStartTime, powerStepDuration[powerStep]);
+        if (adaptivePowerOn && !powerStepDuration[powerStep+1]) {   // Modem boot is probed
+            if (bootProbing) {
+                if (modemSerial->available()) {
+                    return 0;
+                }
+                keepEarliest(deadline, lastBootProbe, SIM7000_BOOT_PROBE_INTERVAL);
+            } else {
+                keepEarliest(deadline, powerStepStartTime, warmState.bootTime / 2);
+            }
+            if (modemStatusPin >= 0 && deadline > SIM7000_BOOT_PROBE_INTERVAL) {
+                deadline = SIM7000_BOOT_PROBE_INTERVAL;             // Poll STATUS pin
+            }
+        }
+        return deadline;
+    }
+    // Data not yet analyzed
+    if (rxNotified || rxPos < rxLen || replayData || modemSerial->available()) {
+        return 0;
+    }
+    // Completion handler or queued command to run
+    if (cmdState == SIM7000_CMD_DONE
+            || (cmdState == SIM7000_CMD_NONE && cmdQueueCount && gsmIdle == SIM7000_IDLE && !restartNeeded)) {
+        return 0;
+    }
+    if (gsmIdle == SIM7000_IDLE && !restartNeeded) {
+        if (queueSending || (!smsQueue.isEmpty() && !holdStartTime)) { // SMS to send (or to remove from queue)
+            return 0;
+        }
+        if (holdStartTime) {                                        // Multi-part SMS held
+            keepEarliest(deadline, holdStartTime, SIM7000_MAX_HOLD_TIME);
+        }
+        if (telemetryInterval && (smsQueue.isEmpty() || holdStartTime)) {
+            keepEarliest(deadline, lastTelemetryTime, holdStartTime ? SIM7000_HOLD_POLL_INTERVAL : telemetryInterval);
+        }
+        if (cleanupPending) {
+            keepEarliest(deadline, lastSmsTime, SIM7000_CLEANUP_DELAY);
+        }
+        #ifdef FF_SIM7000_STORE_AND_DRAIN
+            if (smsStored) {
+                return 0;
+            }
+            keepEarliest(deadline, lastDrainTime, SIM7000_DRAIN_INTERVAL);
+        #endif
+    }
+    // Command answer time-out or end of wait
+    if (cmdState == SIM7000_CMD_SMS_READY && smsReady) {
+        return 0;
+    }
+    if (cmdState == SIM7000_CMD_ANSWER || cmdState == SIM7000_CMD_DELAY || cmdState == SIM7000_CMD_SMS_READY) {
+        keepEarliest(deadline, startTime, gsmTimeout);
+    }
+    // Multi-part received SMS time-out (checked by dispatchEvents() when callbacks are deferred)
+    #if SIM7000_REASSEMBLY_SLOTS > 0
+        for (uint8_t i = 0; !deferCallbacks && i < SIM7000_REASSEMBLY_SLOTS; i++) {
+            if (reassemblySlot[i].inUse) {
+                keepEarliest(deadline, reassemblySlot[i].startTime, SIM7000_REASSEMBLY_TIMEOUT);
+            }
+        }
+    #endif
+    return deadline;
+}
+
+/*!
+
+    \brief  Signal that modem sent data
+
+    This routine only sets a flag, and may be called from an UART interrupt or event callback.
+        getNextDeadline() then returns 0 until next doLoop() call.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::notifyRxData(void) {
+    rxNotified = true;
+}
+
+/*!
+
+    \brief  [Private] Modem loop body (called by doLoop())
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::runLoop(void) {
+    // Are we in modem power steps?
+    if (powerStepStartTime) {
+        // Is current step finished
+        if ((millis() - powerStepStartTime) >= powerStepDuration[powerStep]) {
+            // Set power pin level
+            powerStep++;
+            setPowerPin();
+            // Is this the last power step?
+            if (!powerStepDuration[powerStep]) {
+                endPowerSteps();
+            }
+        } else if (adaptivePowerOn && !powerStepDuration[powerStep+1] && checkModemBoot()) {
+            // Modem booted before end of last power step
+            warmState.bootTime = warmState.bootTime ? (warmState.bootTime * 3 + (millis() - powerStepStartTime)) / 4 : millis() - powerStepStartTime;
+            trace_info_P("Modem booted in %d ms, learned boot time %d ms", millis() - powerStepStartTime, warmState.bootTime);
+            powerStep++;
+            setPowerPin();
+            endPowerSteps();
+        }
+    } else {
+        // Call completion handler of last command, or start next queued one
+        dispatchCommand();
+        // Poll signal and registration if modem is idle (and no SMS is waiting, except a held one)
+        if (telemetryInterval && gsmIdle == SIM7000_IDLE && cmdState == SIM7000_CMD_NONE && !restartNeeded
+                && !queueSending && (smsQueue.isEmpty() || holdStartTime)
+                && (millis() - lastTelemetryTime) >= (holdStartTime ? SIM7000_HOLD_POLL_INTERVAL : telemetryInterval)) {
+            pollTelemetry();
+        }
+        // Start next queued SMS if modem is idle
+        if (gsmIdle == SIM7000_IDLE && cmdState == SIM7000_CMD_NONE) {
+            checkSmsQueue();
+        }
+        // Delete received messages if cleanup has been deferred and modem is still idle
+        if (cleanupPending && gsmIdle == SIM7000_IDLE && cmdState == SIM7000_CMD_NONE && !restartNeeded && smsQueue.isEmpty()
+                && (millis() - lastSmsTime) >= SIM7000_CLEANUP_DELAY) {
+            cleanupPending = false;
+            gsmIdle = SIM7000_RECV;
+            deleteSMS(1,2);
+        }
+        #ifdef FF_SIM7000_STORE_AND_DRAIN
+            // Read stored SMS if signaled or periodically, if modem is still idle
+            if (gsmIdle == SIM7000_IDLE && cmdState == SIM7000_CMD_NONE && !restartNeeded
+                    && (smsStored || (millis() - lastDrainTime) >= SIM7000_DRAIN_INTERVAL)) {
+                drainStoredSms();
+            }
+        #endif
+        #if SIM7000_REASSEMBLY_SLOTS > 0
+            if (!deferCallbacks) {                                  // Else, reassembly is run by dispatchEvents()
+                checkReassemblyTimeout();
+            }
+        #endif
+        // Read modem until \n (LF) character found, removing \r (CR)
+        int readStatus;
+        while ((readStatus = readModem()) == READ_LINE) {
+            dispatchCommand();                                      // Run completion handler outside of line analysis
+            if (!loopBudget || (micros() - loopStartTime) >= loopBudget) {
+                return;                                             // Line handled, continue at next call
+            }
+        }
+        if (readStatus == READ_PAUSED) {
+            return;                                                 // Don't check time-out while answer may still be in buffer
+        }
+
+        switch (cmdState) {
+        case SIM7000_CMD_ANSWER:                                    // We're waiting for a command answer
+            if ((millis() - startTime) >= gsmTimeout) {
+                lastAnswer[answerLen] = 0;                          // Terminate partial answer to display it
+                recordCommand(SIM7000_TIMEOUT);
+                // Should we repeat command?
+                if (cmdRetries) {
+                    cmdRetries--;
+                    if (debugFlag) trace_debug_P("Sending again: %s", lastCommand);
+                    resetLastAnswer();
+                    writeModem(lastCommand);
+                    writeModem("\r");
+                    startTime = millis();
+                    return;
+                }
+                if (probingSpeed || inTelemetry) {                  // No answer at this speed or to poll, let handler decide
+                    completeCommand(SIM7000_TIMEOUT);
+                    break;
+                }
+                if (ignoreErrors) {                                 // If errors should be ignored, call next step, if any
+                    trace_error_P("Ignoring time out after %d ms, received >%s<, command was %s", millis() - startTime, lastAnswer, lastCommand);
+                    completeCommand(SIM7000_TIMEOUT);
+                    break;
+                }
+                if (commandClass == SIM7000_CLASS_CMGS_PROMPT || commandClass == SIM7000_CLASS_CMGS_CONFIRM) {
+                    trace_error_P("SMS chunk timed out after %d ms, received >%s<", millis() - startTime, lastAnswer);
+                    smsErrorClass = SIM7000_SMS_ERROR_RETRY;
+                    nextStepCb = &FF_Sim7000::smsSendError;
+                    completeCommand(SIM7000_TIMEOUT);
+                    break;
+                }
+                if (answerLen) {
+                    trace_error_P("Partial answer: >%s< after %d ms, command was %s", lastAnswer, millis() - startTime, lastCommand);
+                    gsmStatus = SIM7000_BAD_ANSWER;
+                } else {                                            // Time-out without any anwser
+                    trace_error_P("Timed out after %d ms, received >%s<, command was %s", millis() - startTime, lastAnswer, lastCommand);
+                    gsmStatus = SIM7000_TIMEOUT;
+                }
+                restartNeeded = true;
+                restartReason = gsmStatus;
+                setIdle();
+            }
+            break;
+        case SIM7000_CMD_SMS_READY:                                 // We're waiting for SMS ready (or end of wait)
+            if (smsReady) {
+                lastAnswer[answerLen] = 0;
+                if (debugFlag) trace_debug_P("End of %d ms SMS ready wait, received >%s<", millis() - startTime, lastAnswer);
+                completeCommand(SIM7000_OK);
+                break;
+            }
+            // fall through
+        case SIM7000_CMD_DELAY:                                     // We're waiting for some time
+            if ((millis() - startTime) >= gsmTimeout) {
+                lastAnswer[answerLen] = 0;
+                if (debugFlag) trace_debug_P("End of %d ms wait, received >%s<", millis() - startTime, lastAnswer);
+                completeCommand(SIM7000_OK);
+            }
+            break;
+        }
+        dispatchCommand();
+    }
+}
+
+/*!
+
+    \brief  [Private] End running command
+
+    Completion handler (or setIdle() if none) is not called here, but by dispatchCommand(), from runLoop(),
+        so that it never runs from inside line analysis.
+
+    \param[in]  status: command status (SIM7000_OK, SIM7000_TIMEOUT, SIM7000_CM_ERROR...)
+    \return none
+
+*/
+void FF_Sim7000::completeCommand(int status) {
+    gsmStatus = status;
+    cmdState = SIM7000_CMD_DONE;
+}
+
+/*!
+
+    \brief  [Private] Command dispatcher
+
+    Calls completion handler of ended command, then sends oldest queued command if modem is idle.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::dispatchCommand(void) {
+    if (cmdState == SIM7000_CMD_DONE) {
+        cmdState = SIM7000_CMD_NONE;
+        if (nextStepCb) {                                           // Do we have another callback to execute?
+            (this->*nextStepCb)();                                  // Yes, do it
+        } else {
+            setIdle();                                              // No, we just finished.
+        }
+    }
+    if (cmdState == SIM7000_CMD_NONE && cmdQueueCount && gsmIdle == SIM7000_IDLE && !restartNeeded) {
+        FF_Sim7000Command &next = cmdQueue[cmdQueueRead];
+        cmdQueueRead = (cmdQueueRead + 1) % SIM7000_CMD_QUEUE_SIZE;
+        cmdQueueCount--;
+        if (next.answer) {
+            sendCommand(next.command, next.onComplete, next.answer, next.timeout, next.retries);
+        } else {
+            if (debugFlag) trace_debug_P("Issuing command: %s (answer ignored)", next.command);
+            writeModem(next.command);
+            writeModem("\r");
+        }
+    }
+}
+
+/*!
+
+    \brief  [Private] Queue a command, to be sent by dispatcher when modem is idle
+
+    \param[in]  command: command to send
+    \param[in]  onComplete: routine to call when command ends (NULL to set modem idle)
+    \param[in]  answer: expected answer (NULL to send command without waiting for answer)
+    \param[in]  timeout: max time to wait for answer (ms)
+    \param[in]  retries: count of times command is sent again after a time-out
+    \return true if command has been queued, false if queue is full or command too long
+
+*/
+bool FF_Sim7000::queueCommand(const char* command, void (FF_Sim7000::*onComplete)(void), const char* answer, unsigned long timeout, uint8_t retries) {
+    SIM7000_ENTER_ROUTINE();
+    if (cmdQueueCount >= SIM7000_CMD_QUEUE_SIZE || strlen(command) >= SIM7000_MAX_COMMAND_LEN) {
+        trace_error_P("Can't queue command %s", command);
+        return false;
+    }
+    FF_Sim7000Command &slot = cmdQueue[(cmdQueueRead + cmdQueueCount) % SIM7000_CMD_QUEUE_SIZE];
+    strcpy(slot.command, command);
+    slot.answer = answer;
+    slot.timeout = timeout;
+    slot.retries = retries;
+    slot.onComplete = onComplete;
+    cmdQueueCount++;
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Read and analyze data sent by modem
+
+    Data is read by chunks of SIM7000_RX_CHUNK_SIZE bytes, up to SIM7000_MAX_BYTES_PER_LOOP bytes per call, and while loopBudget is not elapsed.
+        Each chunk is scanned for CR, LF, NULL and one character answer, other characters being copied at once into lastAnswer.
+        Chunk is kept between calls, so remaining data is analyzed at next call after a line has been handled.
+
+    \param  none
+    \return READ_LINE if a line (or one character answer) has been handled, READ_EMPTY if no more data to analyze,
+        READ_PAUSED if limits have been reached before end of data
+
+*/
+int FF_Sim7000::readModem(void) {
+    size_t bytesRead = 0;                                           // Bytes read during this call
+    while (true) {
+        // Is current chunk fully analyzed?
+        if (rxPos >= rxLen) {
+            int available = replayData ? (int) replayLength : modemSerial->available();
+            if (available <= 0) {
+                return READ_EMPTY;                                  // Nothing more to read
+            }
+            if ((SIM7000_MAX_BYTES_PER_LOOP && bytesRead >= SIM7000_MAX_BYTES_PER_LOOP)
+                    || (loopBudget && (micros() - loopStartTime) >= loopBudget)) {
+                return READ_PAUSED;                                 // Enough for this time
+            }
+            size_t toRead = (size_t) available < sizeof(rxBuffer) ? (size_t) available : sizeof(rxBuffer);
+            if (replayData) {                                       // Take data from replay buffer
+                memcpy(rxBuffer, replayData, toRead);
+                replayData += toRead;
+                replayLength -= toRead;
+                rxLen = toRead;
+            } else {
+                rxLen = modemSerial->readBytes(rxBuffer, toRead);
+                #ifdef FF_SIM7000_CAPTURE
+                    captureData(false, rxBuffer, rxLen);
+                #endif
+            }
+            rxPos = 0;
+            if (!rxLen) {
+                return READ_EMPTY;
+            }
+            bytesRead += rxLen;
+            metrics.rxBytes += rxLen;
+            // Flag modem speaking
+            modemSpeaking = true;
+            #ifdef FF_SIM7000_DUMP_MESSAGE_ON_SERIAL
+                for (size_t i = 0; i < rxLen; i++) {
+                    if (rxBuffer[i] == 0) {
+                        Serial.print("<NULL>");
+                    } else if (rxBuffer[i] == 13) {
+                        Serial.print("<CR>");
+                    } else if (rxBuffer[i] == 10) {
+                        Serial.print("<LF>");
+                    } else {
+                        Serial.print(rxBuffer[i]);
+                    }
+                }
+            #endif
+        }
+        // Look for next special character (control characters and one character answer)
+        char prompt = (expectedLength == 1) ? expectedAnswer[0] : 0;
+        size_t runStart = rxPos;
+        while (rxPos < rxLen && (uint8_t) rxBuffer[rxPos] > 13 && rxBuffer[rxPos] != prompt) {
+            rxPos++;
+        }
+        // Copy normal characters
+        size_t runLen = rxPos - runStart;
+        if (runLen) {
+            if (answerLen + runLen >= answerSize) {
+                // Answer is too long
+                lastAnswer[answerLen] = 0;
+                trace_error_P("Answer too long: >%s<", lastAnswer);
+                gsmStatus = SIM7000_TOO_LONG;
+                resetLastAnswer();
+                return READ_LINE;
+            }
+            // Check if line starts with an unsolicited message prefix
+            for (size_t i = 0; urcCandidates && i < runLen; i++) {
+                matchUrc(answerLen + i, rxBuffer[runStart + i]);
+            }
+            memcpy(lastAnswer + answerLen, rxBuffer + runStart, runLen);
+            answerLen += runLen;
+        }
+        if (rxPos >= rxLen) {
+            continue;                                               // End of chunk, read next one
+        }
+        char c = rxBuffer[rxPos++];
+        // Skip NULL and CR characters
+        if (c == 0 || c == 13) {
+            continue;
+        }
+        // Do we have an answer?
+        if (c == 10) {
+            if (answerLen) {                                        // Answer is not null
+                lastAnswer[answerLen] = 0;                          // Line is complete, terminate it
+                metrics.rxLines++;
+                processLine();
+                return READ_LINE;
+            }
+            continue;
+        }
+        // Here, we got either a one character answer (like '>' when sending SMS) which have no <CR><LF>,
+        //  or another control character, kept as ordinary data
+        if (answerLen >= answerSize-1) {
+            lastAnswer[answerLen] = 0;
+            trace_error_P("Answer too long: >%s<", lastAnswer);
+            gsmStatus = SIM7000_TOO_LONG;
+            resetLastAnswer();
+            return READ_LINE;
+        }
+        if (urcCandidates) {
+            matchUrc(answerLen, c);
+        }
+        lastAnswer[answerLen++] = c;
+        if (c != prompt) {
+            continue;
+        }
+        lastAnswer[answerLen] = 0;
+        if (cmdState != SIM7000_CMD_ANSWER) {                       // Not waiting for an answer, ignore it
+            if (debugFlag) trace_debug_P("Ignoring >%s<", lastAnswer);
+            resetLastAnswer();
+            return READ_LINE;
+        }
+        if (debugFlag) trace_debug_P("Reply in %d ms: >%s<", millis() - startTime, lastAnswer);
+        recordCommand(SIM7000_OK);
+        completeCommand(SIM7000_OK);
+        return READ_LINE;
+    }
+}
+
+/*!
+
+    \brief  [Private] Handle a complete line received from modem
+
+    Line is dispatched in one pass: unsolicited message recognized while receiving line, expected command answer,
+        SMS message following a SMS header, or unknown data given to line callback.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::processLine(void) {
+    SIM7000_ENTER_ROUTINE();
+    // Do we have an unsolicited message willing to handle this line?
+    if (urcMatch < URC_COUNT && (this->*urcTable[urcMatch].handler)()) {
+        return;
+    }
+    if (cmdState == SIM7000_CMD_ANSWER) {                           // Are we waiting for a command answer?
+        // Is this the expected answer? (exact match for default answer, prefix match else)
+        if (isDefaultAnswer ? (answerLen == expectedLength && !memcmp(lastAnswer, expectedAnswer, expectedLength))
+                : (answerLen >= expectedLength && !memcmp(lastAnswer, expectedAnswer, expectedLength))) {
+            if (debugFlag) trace_debug_P("Reply in %d ms: >%s<", millis() - startTime, lastAnswer);
+            recordCommand(SIM7000_OK);
+            completeCommand(SIM7000_OK);
+            return;
+        }
+        // Bare ERROR on a grouped init step (first group is sent before +CMEE is set): split it as for +CME ERROR
+        if (answerLen == sizeof(ERROR_ANSWER) - 1 && !memcmp(lastAnswer, ERROR_ANSWER, answerLen)
+                && (groupSplit || inGroupedInitStep()) && gotCmError()) {
+            return;
+        }
+    }
+    if (nextLineIsSmsMessage) {                                     // Are we receiving a SMS message?
+        if (debugFlag) trace_debug_P("Message is >%s<", lastAnswer);    // Display cleaned message
+        readSmsMessage(lastAnswer);                                 // Yes, read it
+        resetLastAnswer();
+        nextLineIsSmsMessage = false;                               // Clear flag
+        return;
+    }
+    // Line of test transfer answer (including echo)? Add it to answer hash (FNV-1a, lines separated by LF)
+    if (probingSpeed && speedTestCount) {
+        for (size_t i = 0; i <= answerLen; i++) {
+            speedTestHash = (speedTestHash ^ (i < answerLen ? (uint8_t) lastAnswer[i] : '\n')) * 16777619UL;
+        }
+        resetLastAnswer();
+        return;
+    }
+    // Answer to warm start query?
+    if (inWarmQuery && checkWarmLine()) {
+        return;
+    }
+    // Can't understand received data
+    if (debugFlag) trace_debug_P("Ignoring >%s<", lastAnswer);      // Display cleaned message
+    if (recvLineCb) {
+        if (deferCallbacks) {                                       // Keep line, callback will be called by dispatchEvents()
+            if (!eventQueue.push(EVENT_LINE, lastAnswer)) {
+                trace_error_P("Event queue full, dropping line >%s<", lastAnswer);
+            }
+        } else {
+            (*recvLineCb)(lastAnswer);                              // Activate callback with answer
+        }
+    }
+    resetLastAnswer();
+}
+
+/*!
+
+    \brief  [Private] Match a received character against unsolicited messages prefixes
+
+    Each entry of urcTable still matching the beginning of line is flagged in urcCandidates.
+        When one entry fully matches, its index is saved in urcMatch.
+
+    \param[in]  position: position of character in line
+    \param[in]  c: received character
+    \return none
+
+*/
+void FF_Sim7000::matchUrc(size_t position, char c) {
+    for (uint8_t i = 0; i < URC_COUNT; i++) {
+        if (urcCandidates & (1 << i)) {
+            if (urcTable[i].prefix[position] != c) {
+                urcCandidates &= ~(1 << i);                         // Not this one
+            } else if (position + 1 == urcTable[i].length) {
+                urcMatch = i;                                       // Full prefix found
+                urcCandidates = 0;
+                return;
+            }
+        }
+    }
+}
+
+/*!
+
+    \brief  [Private] Handle a network registration message
+
+    Message could be an unsolicited one (+CREG: <state>[,"<lac>","<ci>"]) or an answer to CREG_QUERY
+        (+CREG: <mode>,<state>[,"<lac>","<ci>"]). They're told apart by second field, which is only a number in answer.
+
+    \param  none
+    \return true, as line is consumed
+
+*/
+bool FF_Sim7000::gotCreg(void) {
+    // Skip message length (except ending \0)
+    char *ptrStr = lastAnswer + sizeof(CREG_MSG) - 1;
+    // Is this an answer to CREG_QUERY? (state is just after mode and comma)
+    if (ptrStr[0] && ptrStr[1] == ',' && ptrStr[2] >= '0' && ptrStr[2] <= '9') {
+        ptrStr += 2;
+    }
+    // Extract state
+    char result = ptrStr[0];
+    if (debugFlag) trace_debug_P("Got %s, state: %c", lastAnswer, result);
+    smsReady = (result == '1' || result == '5');
+    regState = (result >= '0' && result <= '9') ? result - '0' : 0;
+    resetLastAnswer();
+    return true;
+}
+
+// Extract up to count (signed) numbers from a date string, skipping separators (returns count of numbers found)
+static uint8_t parseDateNumbers(const char* str, int* values, uint8_t count) {
+    uint8_t found = 0;
+    while (*str && found < count) {
+        if ((*str >= '0' && *str <= '9') || ((*str == '+' || *str == '-') && str[1] >= '0' && str[1] <= '9')) {
+            char* end;
+            values[found++] = strtol(str, &end, 10);
+            str = end;
+        } else {
+            str++;
+        }
+    }
+    return found;
+}
+
+#define TM_YEAR 0
+#define TM_MONTH 1
+#define TM_DAY 2
+#define TM_HOUR 3
+#define TM_MIN 4
+#define TM_SEC 5
+#define TM_QUARTERS_TO_UTC 6
+#define TM_IS_DST 7
+#define TM_VALUE_COUNT 8
+
+// Check extracted date values (modem clock is set to 1980 or 2000 until network gives time)
+static bool dateNumbersOk(const int* values) {
+    return values[TM_YEAR] >= 20 && values[TM_YEAR] < 80 && values[TM_MONTH] >= 1 && values[TM_MONTH] <= 12
+        && values[TM_DAY] >= 1 && values[TM_DAY] <= 31 && values[TM_HOUR] < 24 && values[TM_MIN] < 60 && values[TM_SEC] < 62;
+}
+
+/*!
+
+    \brief  [Private] Handle a network time message and set local time accordingly
+
+    \param  none
+    \return true, as line is consumed
+
+*/
+bool FF_Sim7000::gotNetworkTime(void) {
+    // Format in doc: *PSUTTZ: <year>,<month>,<day>,<hour>,<min>,<sec>,"<timezone>",<dst>
+    // Message received: *PSUTTZ: 25/04/02,09:49:27","+08",1
+    // As you can see, formats are not really the same, so we'll only extract numbers, in order
+    //  (year, month, day, hour, minute, second, quarters to GMT, DST flag)
+    int values[TM_VALUE_COUNT];
+    if (parseDateNumbers(lastAnswer + sizeof(GSM_TIME) - 1, values, TM_VALUE_COUNT) >= TM_SEC + 1 && dateNumbersOk(values)) {
+        setNetworkTime(unixTimeInSeconds(values[TM_SEC], values[TM_MIN], values[TM_HOUR], values[TM_DAY], values[TM_MONTH], values[TM_YEAR] + 2000));
+    } else {
+        if (debugFlag) trace_debug_P("Can't extract time from %s", lastAnswer);
+    }
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Handle modem clock (answer to AT+CCLK?)
+
+    Answer is +CCLK: "yy/MM/dd,hh:mm:ss+zz", local time, zz being quarters of hour from GMT.
+
+    \param  none
+    \return true, as line is consumed
+
+*/
+bool FF_Sim7000::gotClock(void) {
+    int values[TM_VALUE_COUNT];
+    if (parseDateNumbers(lastAnswer + sizeof(CCLK_INDICATOR) - 1, values, TM_QUARTERS_TO_UTC + 1) == TM_QUARTERS_TO_UTC + 1 && dateNumbersOk(values)) {
+        setNetworkTime(unixTimeInSeconds(values[TM_SEC], values[TM_MIN], values[TM_HOUR], values[TM_DAY], values[TM_MONTH], values[TM_YEAR] + 2000)
+            - values[TM_QUARTERS_TO_UTC] * 900);
+    } else {
+        if (debugFlag) trace_debug_P("Modem clock not set: %s", lastAnswer);
+    }
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Save time given by network (and set local time if FF_SIM6000_SET_TIME_FROM_GSM_NETWORK is defined)
+
+    \param[in]  utcTime: Unix time (seconds from 1970, UTC)
+    \return none
+
+*/
+void FF_Sim7000::setNetworkTime(uint32_t utcTime) {
+    syncTime = utcTime;
+    syncMillis = millis();
+    if (debugFlag) trace_debug_P("Network time is %lu", (unsigned long) utcTime);
+    #ifdef FF_SIM6000_SET_TIME_FROM_GSM_NETWORK
+        timeval epoch = {(time_t) utcTime, 0};
+        settimeofday((const timeval*)&epoch, 0);
+    #endif
+}
+
+/*!
+
+    \brief  Return current time
+
+    Time given by network (*PSUTTZ or AT+CCLK?) is used if known, else system time. This routine never blocks.
+
+    \param  none
+    \return Unix time (seconds from 1970, UTC)
+
+*/
+uint32_t FF_Sim7000::getTime(void) {
+    if (syncTime) {
+        return syncTime + (millis() - syncMillis) / 1000;
+    }
+    return (uint32_t) time(NULL);
+}
+
+/*!
+
+    \brief  Return date of last SMS sent
+
+    Date is only formatted (in local time, as "YYYY/MM/DD hh:mm:ss") at first call after SMS has been sent.
+
+    \param  none
+    \return date of last SMS sent (also loaded into lastSentDate)
+
+*/
+const char* FF_Sim7000::getLastSentDate(void) {
+    if (!lastSentDateValid) {
+        time_t sentTime = lastSentTime;
+        struct tm timeinfo;
+        localtime_r(&sentTime, &timeinfo);
+        char dateStr[25];
+        strftime(dateStr, sizeof(dateStr), "%Y/%m/%d %H:%M:%S", &timeinfo);
+        SET_FIELD(lastSentDate, dateStr);
+        lastSentDateValid = true;
+    }
+    return FIELD_STR(lastSentDate);
+}
+
+/*!
+
+    \brief  [Private] Handle a SMS header
+
+    \param  none
+    \return true if line is consumed, false if we're already waiting for a SMS message
+
+*/
+bool FF_Sim7000::gotSmsIndicator(void) {
+    if (nextLineIsSmsMessage) {
+        return false;
+    }
+    if (debugFlag) trace_debug_P("Indicator is >%s<", lastAnswer);  // Display cleaned message
+    readSmsHeader();
+    if (cmdState != SIM7000_CMD_NONE) {                             // Don't disturb running command (or wait), cleanup will be queued
+        smsDuringCommand = true;
+        resetLastAnswer();
+        return true;
+    }
+    smsDuringCommand = false;
+    // Load last command with indicator
+    strncpy(lastCommand, lastAnswer, sizeof(lastCommand)-1);
+    lastCommand[sizeof(lastCommand)-1] = 0;
+    resetLastAnswer();
+    cmdState = SIM7000_CMD_ANSWER;
+    commandClass = SIM7000_CLASS_OTHER;
+    gsmTimeout = 2000;
+    startTime = millis();
+    return true;
+}
+
+#ifdef FF_SIM7000_STORE_AND_DRAIN
+/*!
+
+    \brief  [Private] Handle a SMS stored indicator
+
+    Stored SMS will be read by next drainStoredSms() call.
+
+    \param  none
+    \return true (line is consumed)
+
+*/
+bool FF_Sim7000::gotSmsStored(void) {
+    if (debugFlag) trace_debug_P("Stored indicator is >%s<", lastAnswer);
+    smsStored = true;
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Handle a stored SMS header, in AT+CMGL answer
+
+    \param  none
+    \return true if line is consumed, false if we're not reading stored SMS
+
+*/
+bool FF_Sim7000::gotSmsListHeader(void) {
+    if (!inDrain || nextLineIsSmsMessage) {
+        return false;
+    }
+    if (debugFlag) trace_debug_P("List header is >%s<", lastAnswer);
+    nextLineIsSmsMessage = true;                                    // PDU is on next line
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Read all SMS stored by modem
+
+    All stored messages are listed by one AT+CMGL command, and deleted at once by drainComplete().
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::drainStoredSms(void) {
+    SIM7000_ENTER_ROUTINE();
+    smsStored = false;
+    inDrain = true;
+    drainReadCount = 0;
+    lastDrainTime = millis();
+    gsmIdle = SIM7000_RECV;
+    sendCommand("AT+CMGL=4", &FF_Sim7000::drainComplete, DEFAULT_ANSWER, 20000);    // List all messages
+}
+
+/*!
+
+    \brief  [Private] End of stored SMS list: delete read messages
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::drainComplete(void) {
+    SIM7000_ENTER_ROUTINE();
+    inDrain = false;
+    if (drainReadCount) {
+        if (debugFlag) trace_debug_P("Read %d stored SMS", drainReadCount);
+        deleteSMS(1, 3);                                            // Delete read and sent messages, keeping ones received since list
+    } else {
+        setIdle();
+    }
+}
+#endif
+
+/*!
+
+    \brief  [Private] Handle a CMS or CME error
+
+    Also called by processLine() for a bare ERROR answer to a grouped init step.
+
+    \param  none
+    \return true if line is consumed, false if we're not waiting for an answer or errors should be ignored
+
+*/
+bool FF_Sim7000::gotCmError(void) {
+    if (cmdState != SIM7000_CMD_ANSWER || ignoreErrors) {
+        return false;
+    }
+    trace_error_P("Error answer: >%s< after %d ms, command was %s", lastAnswer, millis() - startTime, lastCommand);
+    recordCommand(SIM7000_CM_ERROR);
+    if (probingSpeed || inTelemetry) {                              // Let probe or poll routine decide
+        completeCommand(SIM7000_CM_ERROR);
+        return true;
+    }
+    if (commandClass == SIM7000_CLASS_CMGS_PROMPT || commandClass == SIM7000_CLASS_CMGS_CONFIRM) {
+        smsErrorClass = classifySmsError(lastAnswer);               // Classify now, answer will be gone when handler runs
+        nextStepCb = &FF_Sim7000::smsSendError;
+        completeCommand(SIM7000_CM_ERROR);
+        return true;
+    }
+    // Error on a grouped init step: send its commands one by one to find the failing one
+    if (!groupSplit && inGroupedInitStep()) {
+        trace_warn_P("Init step %d failed, sending its commands one by one", stepPtr);
+        groupSplit = true;
+        groupPart = 0;
+        nextStepCb = &FF_Sim7000::sendCurrentInitStep;              // Send first command from doLoop() top level
+        completeCommand(SIM7000_CM_ERROR);
+        return true;
+    }
+    if (groupSplit) {
+        trace_error_P("Init step %d failed on command %d", stepPtr, groupPart + 1);
+    }
+    gsmStatus = SIM7000_CM_ERROR;
+    restartNeeded = true;
+    restartReason = gsmStatus;
+    setIdle();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Check if running command is a grouped init step (several commands separated by ';')
+
+    \param  none
+    \return true if a grouped init step is running, false else
+
+*/
+bool FF_Sim7000::inGroupedInitStep(void) {
+    return gsmIdle == SIM7000_STARTING && nextStepCb == &FF_Sim7000::sendNextInitStep
+        && stepPtr < stepCount && strchr(stepTable[stepPtr].command, ';');
+}
+
+/*!
+
+    \brief  Replay data as if it was sent by modem
+
+    This routine analyzes recorded modem data (like +CREG, *PSUTTZ, +CMT with PDU or +CMS ERROR) through doLoop()
+        exactly as if it was received from modem, in order to reproduce a problem or measure parsing performance
+        (using getMetrics() loop time and received bytes).
+
+    Note that commands triggered by replayed data (like deleting a received SMS) are really sent to modem.
+
+    \param[in]  data: data to analyze
+    \param[in]  length: length of data
+    \return none
+
+*/
+void FF_Sim7000::replay(const char* data, size_t length) {
+    SIM7000_ENTER_ROUTINE();
+    replayData = data;
+    replayLength = length;
+    // Run loop until all data analyzed (data is not read during power steps)
+    while ((replayLength || rxPos < rxLen) && !powerStepStartTime) {
+        doLoop();
+    }
+    replayData = NULL;
+    replayLength = 0;
+}
+
+/*!
+
+    \brief  Trace some internal variables values (user for debug)
+
+    This routine dumps (almost all) variables using trace_info_P macro (usually defined in Ff_TRACE)
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::debugState(void) {
+    SIM7000_ENTER_ROUTINE();
+    trace_info_P("lastCommand=%s", lastCommand);
+    trace_info_P("expectedAnswer=%s", expectedAnswer);
+    lastAnswer[answerLen] = 0;
+    trace_info_P("lastAnswer=%s", lastAnswer);
+    trace_info_P("restartNeeded=%d", restartNeeded);
+    trace_info_P("restartReason=%d", restartReason);
+    trace_info_P("smsReady=%d", smsReady);
+    trace_info_P("gsmIdle=%d", gsmIdle);
+    trace_info_P("cmdState=%d", cmdState);
+    trace_info_P("gsmTimeout=%d", gsmTimeout);
+    trace_info_P("gsmStatus=%d", gsmStatus);
+    trace_info_P("index=%d", index);
+    trace_info_P("powerStep=%d", powerStep);
+    trace_info_P("startTime=%d", millis()-startTime);
+    if (powerStepStartTime) {
+        trace_info_P("powerStepStartTime=%d", millis()-powerStepStartTime);
+    }
+    trace_info_P("firstInitDone=%d", firstInitDone);
+    trace_info_P("modemSpeaking=%d", modemSpeaking);
+    trace_info_P("resetCount=%d", resetCount);
+    trace_info_P("restartCount=%d", restartCount);
+    trace_info_P("commandCount=%d", commandCount);
+    trace_info_P("smsReadCount=%d", smsReadCount);
+    trace_info_P("smsForwardedCount=%d", smsForwardedCount);
+    trace_info_P("smsSentCount=%d", smsSentCount);
+    trace_info_P("queueDepth=%d", smsQueue.getDepth());
+    trace_info_P("queueHighWater=%d", smsQueue.getHighWater());
+    trace_info_P("queueDropCount=%d", smsQueue.getDropCount());
+    trace_info_P("eventQueueDepth=%d", eventQueue.getDepth());
+    trace_info_P("eventQueueDropCount=%d", eventQueue.getDropCount());
+    trace_info_P("Sim7000-debugFlag=%d", debugFlag);
+    trace_info_P("Sim7000-traceFlag=%d", traceFlag);
+    trace_info_P("Sim7000-traceEnterFlag=%d", traceEnterFlag);
+}
+
+/*!
+
+    \brief  Sends an SMS to modem
+
+    This routine pushes an SMS into outbound queue. It'll be sent by doLoop() as soon as modem is idle.
+
+    \param[in]  number: phone number to send message to
+    \param[in]  text: message to send
+    \return true if SMS has been queued, false if queue is full (SMS is dropped)
+
+*/
+bool FF_Sim7000::sendSMS(const char* number, const char* text) {
+    SIM7000_ENTER_ROUTINE();
+    if (!smsQueue.push(number, text)) {
+        trace_error_P("SMS queue full, dropping SMS to %s >%s<", number, text);
+        return false;
+    }
+    if (debugFlag) trace_debug_P("Queued SMS to %s, queue depth %d", number, smsQueue.getDepth());
+    #if defined(ESP32) && !defined(FF_SIM7000_USE_SOFTSERIAL)
+        if (taskHandle) {
+            xTaskNotifyGive(taskHandle);                            // Wake modem task up
+        }
+    #endif
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Start sending first queued SMS
+
+    This routine is called by doLoop() when modem is idle.
+        It removes from queue the SMS which was just sent (if any), then starts sending the next one.
+        If a batch is open and no message is sent now (queue is empty or next message is held), batch is ended.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::checkSmsQueue(void) {
+    if (queueSending) {                                             // Was last SMS taken from queue?
+        releaseQueuedSms(restartNeeded);
+    }
+    if (restartNeeded) {                                            // Don't send anything if modem should be restarted
+        return;
+    }
+    char* number = smsQueue.front();
+    if (number) {
+        char* text = number + strlen(number) + 1;                   // Text is just after number
+        if (!holdMultipartSms(text)) {
+            queueSending = true;
+            sendQueuedSms(number, text);
+            return;
+        }
+    }
+    if (inBatch) {                                                  // Nothing to send now, release radio link
+        gsmIdle = SIM7000_SEND;
+        endSmsBatch();
+    }
+}
+
+/*!
+
+    \brief  [Private] End of first queued SMS sending
+
+    SMS is removed from queue if it has been sent (or dropped). If a restart interrupted it, it's kept in queue
+        to be sent again (from first chunk) once modem is restarted, only once: if it's interrupted again, it's dropped.
+
+    \param[in]  restarting: true if modem is going to be restarted
+    \return none
+
+*/
+void FF_Sim7000::releaseQueuedSms(bool restarting) {
+    queueSending = false;
+    if (!smsDone && restarting && !smsRestarted) {
+        smsRestarted = true;
+        trace_warn_P("SMS to %s interrupted by restart, will be sent again", smsNumber);
+        return;
+    }
+    if (!smsDone) {
+        trace_error_P("SMS to %s interrupted again by restart, dropping it", smsNumber);
+        metrics.smsFailCount++;
+    }
+    smsRestarted = false;
+    smsQueue.pop();
+}
+
+/*!
+
+    \brief  [Private] Check if a queued multi-part SMS should be held because of poor signal
+
+    Message is held while last sample signal quality is below minMultipartCsq, checked again at each new sample,
+        up to SIM7000_MAX_HOLD_TIME ms. Messages queued after it are also held.
+
+    \param[in]  text: message to check
+    \return true if message should not be sent now
+
+*/
+bool FF_Sim7000::holdMultipartSms(char* text) {
+    if (!telemetryInterval || !minMultipartCsq || !telemetryCount) { // No signal information
+        return false;
+    }
+    if (holdStartTime) {
+        if ((millis() - holdStartTime) >= SIM7000_MAX_HOLD_TIME) {
+            trace_warn_P("Signal still poor after %d ms, sending held SMS", millis() - holdStartTime);
+            holdStartTime = 0;
+            return false;
+        }
+        if (holdSampleCount == telemetryTotal) {                    // No new sample since last check
+            return true;
+        }
+    }
+    const FF_Sim7000Sample* last = getSample(0);
+    if (last->csq != SIM7000_CSQ_UNKNOWN && last->csq >= minMultipartCsq) {
+        holdStartTime = 0;
+        return false;
+    }
+    planMessage(text, &smsPlan);
+    if (!smsPlan.chunkCount) {                                      // Single SMS, send it
+        holdStartTime = 0;
+        return false;
+    }
+    if (!holdStartTime) {
+        trace_info_P("Signal is poor (CSQ %d), holding %d parts SMS", last->csq, smsPlan.chunkCount);
+        holdStartTime = millis() | 1;                               // Never 0
+    }
+    holdSampleCount = telemetryTotal;
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Sends an SMS to modem
+
+    This routine pushes an SMS to modem.
+        It determines if message is a GMS7 only message or not (in this case, this will be UCS-2)
+        If message is GSM7, max length of non chunked SMS is 160. For UCS-2, this is 70.
+        When message is longer than these limits, it'll be split in chunks of 152 septets for GSM7, or 67 chars for UCS-2.
+        There's a theoretical limit of 255 chunks, but most of operators are limiting in lower size.
+        It seems that 7 to 8 messages are accepted by almost everyone, meaning 1200 GSM7 chars, or 550 UCS-2 chars.
+
+    Number and message should stay in place until message is fully sent (they're in outbound queue first record).
+        Chunks are given to PDU encoder directly from message, without copy: message is temporary modified
+        in place by encodeSmsChunk(), so queue first record should only be read by modem side.
+
+    \param[in]  number: phone number to send message to
+    \param[in]  text: message to send
+    \return none
+
+*/
+void FF_Sim7000::sendQueuedSms(const char* number, char* text) {
+    SIM7000_ENTER_ROUTINE();
+    planMessage(text, &smsPlan);                                    // Get encoding, length and chunks in one pass
+    smsMsgCount = smsPlan.chunkCount;
+    if (smsMsgCount) {                                              // This is a multi-part message
+        smsMsgId++;
+    }
+    if (smsPlan.isTruncated) {
+        trace_error_P("Message to %s is longer than %d chunks, truncating it", number, SIM7000_MAX_SMS_CHUNKS);
+    }
+    if (debugFlag) trace_info_P("%s, length=%d, msgs=%d", smsPlan.isGsm7 ? "gsm7" : "ucs2", smsPlan.length, smsMsgCount);
+    smsNumber = number;
+    smsText = text;
+    // Save last used number and message
+    SET_FIELD(lastSentNumber, number);
+    SET_FIELD(lastSentMessage, text);
+
+    // Save send time (date will be formatted when read)
+    lastSentTime = getTime();
+    lastSentDateValid = false;
+
+    // Send first (or only) SMS part
+    messageStartTime = millis();
+    preparedLength = 0;
+    smsRetries = 0;
+    smsDone = false;
+    if (batchSend && !inBatch && (smsMsgCount || smsQueue.getDepth() > 1)) {
+        inBatch = true;                                             // Start a batch for multi-part message or queued burst
+        gsmIdle = SIM7000_SEND;
+        sendCommand("AT+CMMS=2", &FF_Sim7000::sendFirstSmsChunk);
+        return;
+    }
+    sendFirstSmsChunk();
+}
+
+/*!
+
+    \brief  [Private] Sends first (or only) chunk of current message
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::sendFirstSmsChunk(void) {
+    if (smsMsgCount == 0) {
+        sendOneSmsChunk(smsNumber, smsText);
+    } else {
+        smsMsgIndex = 0;
+        sendSmsChunk(smsMsgIndex++);                                // Send first chunk
+    }
+}
+
+/*!
+
+    \brief  [Private] Sends one chunk of current multi-part message
+
+    Chunk is encoded by encodeSmsChunk() into current TX PDU workspace, then sent.
+
+    \param[in]  chunk: index of chunk to send (0 for first one)
+    \return none
+
+*/
+void FF_Sim7000::sendSmsChunk(uint8_t chunk) {
+    int len = encodeSmsChunk(chunk, txPduIndex);
+    if (len < 0) {                                                  // See sendOneSmsChunk() for error codes
+        trace_error_P("Encode error %d sending chunk %d/%d to %s", len, chunk + 1, smsMsgCount, smsNumber);
+        smsSendFailed();
+        return;
+    }
+    if (debugFlag) trace_debug_P("Sending chunk %d/%d to %s", chunk + 1, smsMsgCount, smsNumber);
+    sendChunkCommand(len);
+}
+
+/*!
+
+    \brief  [Private] Encodes one chunk of current multi-part message into a TX PDU workspace
+
+    Chunk is given to PDU encoder as a view into message: character just after chunk is temporary
+        replaced by a zero, and restored once chunk has been encoded. As message is outbound queue first
+        record, this record is modified in place during encoding (see FF_Sim7000Queue::front()).
+
+    \param[in]  chunk: index of chunk to encode (0 for first one)
+    \param[in]  workspace: index of TX PDU workspace to use
+    \return PDU length (negative if encoding error)
+
+*/
+int FF_Sim7000::encodeSmsChunk(uint8_t chunk, uint8_t workspace) {
+    char* chunkEnd = smsText + smsPlan.chunkOffset[chunk+1];
+    char savedChar = *chunkEnd;
+    *chunkEnd = 0;
+    int len = smsTxPdu[workspace].encodePDU(smsNumber, smsText + smsPlan.chunkOffset[chunk], smsMsgId, smsMsgCount, chunk + 1);
+    *chunkEnd = savedChar;
+    return len;
+}
+
+/*!
+
+    \brief  [Private] Encodes next chunk of current multi-part message while current one is sent
+
+    Next chunk is encoded into the TX PDU workspace not used by chunk being sent, so that its AT+CMGS
+        command can be sent as soon as "+CMGS:" confirmation of current chunk is received.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::prepareNextSmsChunk(void) {
+    preparedLength = 0;
+    if (smsMsgCount && smsMsgIndex < smsMsgCount) {                 // Do we have more chunks to send ?
+        int len = encodeSmsChunk(smsMsgIndex, txPduIndex ^ 1);
+        if (len > 0) {                                              // Encoding errors will be reported when chunk is sent
+            preparedLength = len;
+            if (debugFlag) trace_debug_P("Prepared chunk %d/%d", smsMsgIndex + 1, smsMsgCount);
+        }
+    }
+}
+
+/*!
+
+    \brief  Sends next SMS chunk to modem
+
+    This routine is called when an SMS chunk has been pushed to modem, to send next part, if it exists
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::sendNextSmsChunk(void){
+    if (smsMsgCount) {                                              // Are we in multi-part message ?
+        if (smsMsgIndex < smsMsgCount) {                            // Do we have more chunks to send ?
+            if (preparedLength > 0) {                               // Next chunk already encoded?
+                int len = preparedLength;
+                preparedLength = 0;
+                txPduIndex ^= 1;                                    // Yes, switch to its workspace
+                smsMsgIndex++;
+                if (debugFlag) trace_debug_P("Sending prepared chunk %d/%d", smsMsgIndex, smsMsgCount);
+                sendChunkCommand(len);
+            } else {
+                sendSmsChunk(smsMsgIndex++);                        // Send next chunk
+            }
+            return;
+        }
+    }
+    smsDone = true;
+    notifySmsSent();
+    if (inBatch) {
+        histogramAdd(metrics.batchMessageSend, millis() - messageStartTime);
+    } else {
+        histogramAdd(metrics.messageSend, millis() - messageStartTime);
+    }
+    setIdle();                                                      // Message has fully be sent
+}
+
+/*!
+
+    \brief  [Private] Give last sent SMS to send callback (or keep it for dispatchEvents())
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::notifySmsSent(void) {
+    if (!sendSmsCb) {
+        return;
+    }
+    if (deferCallbacks) {
+        const char* parts[4] = {EVENT_SMS_SENT, FIELD_STR(lastSentNumber), getLastSentDate(), FIELD_STR(lastSentMessage)};
+        if (!eventQueue.pushParts(parts, 4)) {
+            trace_error_P("Event queue full, dropping sent SMS to %s", FIELD_STR(lastSentNumber));
+        }
+    } else {
+        (*sendSmsCb)(FIELD_STR(lastSentNumber), getLastSentDate(), FIELD_STR(lastSentMessage));
+    }
+}
+
+/*!
+
+    \brief  [Private] Give a modem status change to status callback (or keep it for dispatchEvents())
+
+    \param[in]  status: status change (SIM7000_STATUS_xxx)
+    \param[in]  reason: restart reason, or restart count for SIM7000_STATUS_READY
+    \return none
+
+*/
+void FF_Sim7000::notifyStatus(int status, int reason) {
+    if (!statusCb) {
+        return;
+    }
+    if (deferCallbacks) {
+        char statusStr[8], reasonStr[12];
+        snprintf_P(statusStr, sizeof(statusStr), PSTR("%d"), status);
+        snprintf_P(reasonStr, sizeof(reasonStr), PSTR("%d"), reason);
+        const char* parts[3] = {EVENT_STATUS, statusStr, reasonStr};
+        if (!eventQueue.pushParts(parts, 3)) {
+            trace_error_P("Event queue full, dropping status %d", status);
+        }
+    } else {
+        (*statusCb)(status, reason);
+    }
+}
+
+/*!
+
+    \brief  [Private] Release radio link at end of a batch
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::endSmsBatch(void) {
+    SIM7000_ENTER_ROUTINE();
+    inBatch = false;
+    sendCommand("AT+CMMS=0", &FF_Sim7000::setIdle);
+}
+
+/*!
+
+    \brief  [Private] Sends an SMS chunk to modem
+
+    This routine pushes an SMS chunk to modem, as part of first queued SMS (errors go through its retry and drop
+        handling, so it should not be called outside of queue sending: use sendSMS() instead)
+
+    \param[in]  number: phone number to send message to
+    \param[in]  text: message to send
+    \param[in]  msgId: SMS message identifier (should be incremented for each multi-part message, zero if not multi-part message)
+    \param[in]  msgCount: total number of SMS chunks (zero if not multi-part message)
+    \param[in]  msgIndex: index of this message chunk (zero if not multi-part message)
+    \return none
+
+*/
+void FF_Sim7000::sendOneSmsChunk(const char* number, const char* text, const unsigned short msgId, const unsigned char msgCount, const unsigned char msgIndex) {
+    SIM7000_ENTER_ROUTINE();
+    int len = smsTxPdu[txPduIndex].encodePDU(number, text, msgId, msgCount, msgIndex);
+    if (len < 0)  {
+            // -1: OBSOLETE_ERROR
+            // -2: UCS2_TOO_LONG
+            // -3 GSM7_TOO_LONG
+            // -4 MULTIPART_NUMBERS
             // -5 ADDRESS_FORMAT
             // -6 WORK_BUFFER_TOO_SMALL
             // -7 ALPHABET_8BIT_NOT_SUPPORTED
         trace_error_P("Encode error %d sending SMS to %s >%s<", len, number, text);
+        smsSendFailed();
+        return;
+    }
+
+    if (debugFlag) trace_debug_P("Sending SMS to %s >%s<", number, text);
+    sendChunkCommand(len);
+}
+
+/*!
+
+    \brief  [Private] Handle an error or time-out on current SMS chunk
+
+    Transient errors send chunk again after SIM7000_RETRY_DELAY ms (doubled at each retry), up to SIM7000_SMS_RETRIES
+        times per message, chunks already sent being kept. After a time-out, modem is first checked with an AT command
+        (a modem not answering it is restarted). Message errors (bad number, bad PDU...) drop message, modem or SIM
+        errors (and transient errors still there after all retries) restart modem.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::smsSendError(void) {
+    SIM7000_ENTER_ROUTINE();
+    if (smsErrorClass == SIM7000_SMS_ERROR_RETRY && smsRetries >= SIM7000_SMS_RETRIES) {
+        trace_error_P("SMS to %s still failing after %d retries", smsNumber, smsRetries);
+        smsErrorClass = SIM7000_SMS_ERROR_RESTART;
+    }
+    if (smsErrorClass == SIM7000_SMS_ERROR_FAIL) {
+        smsSendFailed();
+        return;
+    }
+    if (smsErrorClass == SIM7000_SMS_ERROR_RESTART) {
+        restartNeeded = true;
+        restartReason = gsmStatus;
+        setIdle();
+        return;
+    }
+    smsRetries++;
+    metrics.smsRetryCount++;
+    if (gsmStatus == SIM7000_TIMEOUT) {                             // Leave PDU prompt (if any) and check that modem still answers
+        writeModem("\x1b");
+        sendCommand("AT", &FF_Sim7000::waitSmsRetry, DEFAULT_ANSWER, SIM7000_CMD_TIMEOUT, 1);
+        return;
+    }
+    waitSmsRetry();
+}
+
+/*!
+
+    \brief  [Private] Wait before sending current SMS chunk again
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::waitSmsRetry(void) {
+    unsigned long waitMs = (unsigned long) SIM7000_RETRY_DELAY << (smsRetries - 1);
+    trace_warn_P("Sending SMS chunk again in %d ms (retry %d/%d)", waitMs, smsRetries, SIM7000_SMS_RETRIES);
+    waitDelay(waitMs, &FF_Sim7000::resendSmsChunk);
+}
+
+/*!
+
+    \brief  [Private] Send current SMS chunk again
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::resendSmsChunk(void) {
+    SIM7000_ENTER_ROUTINE();
+    if (smsMsgCount) {
+        sendSmsChunk(smsMsgIndex - 1);                              // Index has already been incremented when chunk was sent
+    } else {
+        sendOneSmsChunk(smsNumber, smsText);
+    }
+}
+
+/*!
+
+    \brief  [Private] Drop current SMS after a permanent error, going on with next queued one
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::smsSendFailed(void) {
+    trace_error_P("Can't send SMS to %s, dropping it", smsNumber ? smsNumber : "?");
+    metrics.smsFailCount++;
+    smsDone = true;
+    setIdle();
+}
+
+/*!
+
+    \brief  [Private] Write data to modem
+
+    \param[in]  data: data to write
+    \param[in]  length: length of data
+    \return none
+
+*/
+void FF_Sim7000::writeModem(const char* data, size_t length) {
+    modemSerial->write((const uint8_t*) data, length);
+    #ifdef FF_SIM7000_CAPTURE
+        captureData(true, data, length);
+    #endif
+}
+
+/*!
+
+    \brief  [Private] Write a zero terminated string to modem
+
+    \param[in]  data: string to write
+    \return none
+
+*/
+void FF_Sim7000::writeModem(const char* data) {
+    writeModem(data, strlen(data));
+}
+
+#ifdef FF_SIM7000_CAPTURE
+#if SIM7000_CAPTURE_SIZE < 2 * (SIM7000_CAPTURE_HEADER + SIM7000_CAPTURE_MAX_RECORD) || SIM7000_CAPTURE_SIZE > 65535
+    #error SIM7000_CAPTURE_SIZE should be between 522 and 65535!
+#endif
+/*!
+
+    \brief  [Private] Copy data into capture ring, wrapping at its end
+
+    \param[in]  position: offset in ring
+    \param[in]  data: data to copy
+    \param[in]  length: length of data
+    \return none
+
+*/
+void FF_Sim7000::captureCopy(uint16_t position, const void* data, uint16_t length) {
+    uint16_t first = SIM7000_CAPTURE_SIZE - position;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(captureBuffer + position, data, first);
+    memcpy(captureBuffer, (const uint8_t*) data + first, length - first);
+}
+
+/*!
+
+    \brief  [Private] Copy data out of capture ring, wrapping at its end
+
+    \param[in]  position: offset in ring
+    \param[out]  data: where to copy data
+    \param[in]  length: length of data
+    \return none
+
+*/
+void FF_Sim7000::captureRead(uint16_t position, void* data, uint16_t length) {
+    uint16_t first = SIM7000_CAPTURE_SIZE - position;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(data, captureBuffer + position, first);
+    memcpy((uint8_t*) data + first, captureBuffer, length - first);
+}
+
+/*!
+
+    \brief  [Private] Record data sent to (or received from) modem into capture ring
+
+    Each record is made of a 4 bytes time (millis()), 1 byte direction (1 if sent) and 1 byte length, followed by data.
+        Data in same direction and same millisecond as newest record extends it. Oldest records are dropped when
+        ring is full.
+
+    \param[in]  sent: true if data has been sent to modem, false if received
+    \param[in]  data: data to record
+    \param[in]  length: length of data
+    \return none
+
+*/
+void FF_Sim7000::captureData(bool sent, const char* data, size_t length) {
+    unsigned long now = millis();
+    while (length) {
+        uint8_t lastLength = 0;
+        bool extend = false;
+        if (captureUsed && captureLastSent == sent && captureLastTime == now) {
+            captureRead((captureLast + SIM7000_CAPTURE_HEADER - 1) % SIM7000_CAPTURE_SIZE, &lastLength, 1);
+            extend = lastLength < SIM7000_CAPTURE_MAX_RECORD;
+        }
+        size_t chunk = extend ? SIM7000_CAPTURE_MAX_RECORD - lastLength : SIM7000_CAPTURE_MAX_RECORD;
+        if (chunk > length) {
+            chunk = length;
+        }
+        size_t needed = chunk + (extend ? 0 : SIM7000_CAPTURE_HEADER);
+        while ((size_t) (SIM7000_CAPTURE_SIZE - captureUsed) < needed) { // Drop oldest records until data fits
+            uint8_t oldLength;
+            captureRead((captureStart + SIM7000_CAPTURE_HEADER - 1) % SIM7000_CAPTURE_SIZE, &oldLength, 1);
+            captureStart = (captureStart + SIM7000_CAPTURE_HEADER + oldLength) % SIM7000_CAPTURE_SIZE;
+            captureUsed -= SIM7000_CAPTURE_HEADER + oldLength;
+        }
+        if (extend) {
+            lastLength += chunk;
+            captureCopy((captureLast + SIM7000_CAPTURE_HEADER - 1) % SIM7000_CAPTURE_SIZE, &lastLength, 1);
+        } else {
+            uint8_t header[SIM7000_CAPTURE_HEADER] = {(uint8_t) now, (uint8_t) (now >> 8), (uint8_t) (now >> 16), (uint8_t) (now >> 24),
+                (uint8_t) sent, (uint8_t) chunk};
+            captureLast = captureEnd;
+            captureLastTime = now;
+            captureLastSent = sent;
+            captureCopy(captureEnd, header, SIM7000_CAPTURE_HEADER);
+            captureEnd = (captureEnd + SIM7000_CAPTURE_HEADER) % SIM7000_CAPTURE_SIZE;
+        }
+        captureCopy(captureEnd, data, chunk);
+        captureEnd = (captureEnd + chunk) % SIM7000_CAPTURE_SIZE;
+        captureUsed += needed;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+/*!
+
+    \brief  Register a capture dump callback routine
+
+    Callback routine will be called by dumpCapture() for each record, from oldest to newest, with 4 parameters:
+        (unsigned long) time: millis() value when data has been sent or received
+        (bool) sent: true if data has been sent to modem, false if received from modem
+        (const char*) data: data (not zero terminated)
+        (size_t) length: length of data
+
+    Concatenating data of received records gives modem data as replay() expects it (extras/bench -r option
+        replays such a file on a host, and -w writes one).
+
+    \param[in]  routine to call for each capture record
+    \return none
+
+*/
+void FF_Sim7000::registerCaptureCb(void (*captureCallback)(unsigned long __time, bool __sent, const char* __data, size_t __length)) {
+    SIM7000_ENTER_ROUTINE();
+    captureCb = captureCallback;
+}
+
+/*!
+
+    \brief  Give capture ring content to capture callback
+
+    This routine is automatically called once when a modem restart is needed. Ring is not cleared.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::dumpCapture(void) {
+    if (!captureCb) {
         return;
     }
+    char record[SIM7000_CAPTURE_MAX_RECORD];
+    uint16_t position = captureStart;
+    uint16_t remaining = captureUsed;
+    while (remaining) {
+        uint8_t header[SIM7000_CAPTURE_HEADER];
+        captureRead(position, header, SIM7000_CAPTURE_HEADER);
+        uint8_t length = header[SIM7000_CAPTURE_HEADER - 1];
+        captureRead((position + SIM7000_CAPTURE_HEADER) % SIM7000_CAPTURE_SIZE, record, length);
+        (*captureCb)(header[0] | (header[1] << 8) | ((unsigned long) header[2] << 16) | ((unsigned long) header[3] << 24),
+            header[4] != 0, record, length);
+        position = (position + SIM7000_CAPTURE_HEADER + length) % SIM7000_CAPTURE_SIZE;
+        remaining -= SIM7000_CAPTURE_HEADER + length;
+    }
+}
 
-    if (debugFlag) trace_debug_P("Sending SMS to %s >%s<", number, text);
+/*!
+
+    \brief  Empty capture ring
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::clearCapture(void) {
+    captureStart = 0;
+    captureEnd = 0;
+    captureUsed = 0;
+    captureLast = 0;
+    captureLastTime = 0;
+    captureLastSent = false;
+}
+#endif
+
+/*!
+
+    \brief  [Private] Sends AT+CMGS command for chunk encoded in current TX PDU workspace
+
+    \param[in]  length: PDU length
+    \return none
+
+*/
+void FF_Sim7000::sendChunkCommand(int length) {
+    char tempBuffer[50];
+    chunkStartTime = millis();
     gsmIdle = SIM7000_SEND;
     smsSentCount++;
-    snprintf_P(tempBuffer, sizeof(tempBuffer),PSTR("AT+CMGS=%d"), len);
+    snprintf_P(tempBuffer, sizeof(tempBuffer),PSTR("AT+CMGS=%d"), length);
     sendCommand(tempBuffer, &FF_Sim7000::sendSMStext, ">", 15000);
 }
 
@@ -702,7 +2431,7 @@ void FF_Sim7000::sendOneSmsChunk(const char* number, const char* text, const uns
 
 */
 void FF_Sim7000::registerSmsCb(void (*readSmsCallback)(const char* __number, const char* __date, const char* __message)) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     readSmsCb = readSmsCallback;
 }
 
@@ -722,7 +2451,7 @@ void FF_Sim7000::registerSmsCb(void (*readSmsCallback)(const char* __number, con
 
 */
 void FF_Sim7000::registerSendCb(void (*sendSmsCallback)(const char* __number, const char* __date, const char* __message)) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     sendSmsCb = sendSmsCallback;
 }
 
@@ -740,10 +2469,29 @@ void FF_Sim7000::registerSendCb(void (*sendSmsCallback)(const char* __number, co
 
 */
 void FF_Sim7000::registerLineCb(void (*recvLineCallback)(const char* __answer)) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     recvLineCb = recvLineCallback;
 }
 
+/*!
+
+    \brief  Register a modem status callback routine
+
+    This routine register a callback routine to call when modem status changes
+
+    Callback routine will be called with 2 parameters:
+        (int) status: SIM7000_STATUS_READY (init done), SIM7000_STATUS_INIT_FAILED or SIM7000_STATUS_RESTART (modem should be restarted)
+        (int) reason: restart count for SIM7000_STATUS_READY, else restart reason (as getRestartReason())
+
+    \param[in]  routine to call when modem status changes
+    \return none
+
+*/
+void FF_Sim7000::registerStatusCb(void (*statusCallback)(int __status, int __reason)) {
+    SIM7000_ENTER_ROUTINE();
+    statusCb = statusCallback;
+}
+
 /*!
 
     \brief  Send next init step  message
@@ -753,15 +2501,41 @@ void FF_Sim7000::registerLineCb(void (*recvLineCallback)(const char* __answer))
 
 */
 void FF_Sim7000::sendNextInitStep(void){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     stepPtr++;
-    if (stepPtr < STEP_SIZE) {
+    if (stepPtr < stepCount) {
         sendCurrentInitStep();
     } else {
         initComplete();
     }
 }
 
+/*!
+
+    \brief  [Private] Send next command of a grouped init step (when sent one by one)
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::sendNextGroupPart(void) {
+    SIM7000_ENTER_ROUTINE();
+    const char* partStart = stepTable[stepPtr].command;
+    for (uint8_t i = 0; i <= groupPart && partStart; i++) {
+        partStart = strchr(partStart, ';');
+        if (partStart) {
+            partStart++;
+        }
+    }
+    if (partStart && *partStart) {                                  // Do we have another command in group?
+        groupPart++;
+        sendCurrentInitStep();
+        return;
+    }
+    groupSplit = false;                                             // Group done, go to next step
+    sendNextInitStep();
+}
+
 /*!
 
     \brief  Send current init step  message
@@ -772,27 +2546,41 @@ void FF_Sim7000::sendNextInitStep(void){
 
 */
 void FF_Sim7000::sendCurrentInitStep(void){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     // check for stepPtr into table
-    if (stepPtr < STEP_SIZE) {
+    if (stepPtr < stepCount) {
         // Do we have a routine to run ?
-        if (initSteps[stepPtr].nextStep) {
+        if (stepTable[stepPtr].nextStep) {
             trace_debug_P("sendCurrentInitStep %d - Call routine", stepPtr);
-            (this->*initSteps[stepPtr].nextStep)();
+            (this->*stepTable[stepPtr].nextStep)();
+        } else if (groupSplit) {
+            // Send one command of grouped step (first one starts with "AT", others only contain command)
+            char tempBuffer[50];
+            const char* partStart = stepTable[stepPtr].command;
+            for (uint8_t i = 0; i < groupPart && partStart; i++) {
+                partStart = strchr(partStart, ';');
+                if (partStart) {
+                    partStart++;
+                }
+            }
+            size_t partLen = strcspn(partStart, ";");
+            snprintf_P(tempBuffer, sizeof(tempBuffer), PSTR("%s%.*s"), groupPart ? "AT" : "", (int) partLen, partStart);
+            trace_debug_P("sendCurrentInitStep %d - Send part %d: %s", stepPtr, groupPart, tempBuffer);
+            sendCommand(tempBuffer, &FF_Sim7000::sendNextGroupPart, DEFAULT_ANSWER, stepTable[stepPtr].timeout, stepTable[stepPtr].repeat);
         } else {
             // No routine, send data
-            if (*initSteps[stepPtr].waitFor) {
+            if (*stepTable[stepPtr].waitFor) {
                     // We have a specific data to wait for
-                trace_debug_P("sendCurrentInitStep %d - Send %s, wait for %s, timeout %d, repeat %d", stepPtr, initSteps[stepPtr].command, initSteps[stepPtr].waitFor, initSteps[stepPtr].timeout, initSteps[stepPtr].repeat);
-                sendCommand(initSteps[stepPtr].command, &FF_Sim7000::sendNextInitStep, initSteps[stepPtr].waitFor, initSteps[stepPtr].timeout), initSteps[stepPtr].repeat;
+                trace_debug_P("sendCurrentInitStep %d - Send %s, wait for %s, timeout %d, repeat %d", stepPtr, stepTable[stepPtr].command, stepTable[stepPtr].waitFor, stepTable[stepPtr].timeout, stepTable[stepPtr].repeat);
+                sendCommand(stepTable[stepPtr].command, &FF_Sim7000::sendNextInitStep, stepTable[stepPtr].waitFor, stepTable[stepPtr].timeout, stepTable[stepPtr].repeat);
             } else {
                 // Use default answer
-                trace_debug_P("sendCurrentInitStep %d - Send %s, wait for %s, timeout %d, repeat %d", stepPtr, initSteps[stepPtr].command, DEFAULT_ANSWER, initSteps[stepPtr].timeout, initSteps[stepPtr].repeat);
-                sendCommand(initSteps[stepPtr].command, &FF_Sim7000::sendNextInitStep, DEFAULT_ANSWER, initSteps[stepPtr].timeout, initSteps[stepPtr].repeat);
+                trace_debug_P("sendCurrentInitStep %d - Send %s, wait for %s, timeout %d, repeat %d", stepPtr, stepTable[stepPtr].command, DEFAULT_ANSWER, stepTable[stepPtr].timeout, stepTable[stepPtr].repeat);
+                sendCommand(stepTable[stepPtr].command, &FF_Sim7000::sendNextInitStep, DEFAULT_ANSWER, stepTable[stepPtr].timeout, stepTable[stepPtr].repeat);
             }
         }
     } else {
-        trace_error_P("Trying to execute step %d, max is %d", stepPtr, sizeof(initSteps));
+        trace_error_P("Trying to execute step %d, max is %d", stepPtr, stepCount);
     }
 }
 
@@ -807,7 +2595,7 @@ void FF_Sim7000::sendCurrentInitStep(void){
 
 */
 void FF_Sim7000::deleteSMS(int index, int flag) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     char tempBuffer[50];
 
     snprintf_P(tempBuffer, sizeof(tempBuffer), PSTR("AT+CMGD=%d,%d"), index, flag);
@@ -822,16 +2610,15 @@ void FF_Sim7000::deleteSMS(int index, int flag) {
 
     It could be used to debug/test modem.
 
-    Modem answer is ignored and discarded.
+    Command is queued, and sent by dispatcher once modem is idle. Modem answer is ignored and discarded.
 
     \param[in]  AT command to be send
     \return none
 
 */
 void FF_Sim7000::sendAT(const char *command) {
-    if (traceFlag) enterRoutine(__func__);
-    sendCommand(command);
-    inReceive = false;
+    SIM7000_ENTER_ROUTINE();
+    queueCommand(command, NULL, NULL);
 }
 
 /*!
@@ -849,9 +2636,9 @@ void FF_Sim7000::sendAT(const char *command) {
 
 */
 void FF_Sim7000::sendEOF(void) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     sendCommand(0x1a);
-    inReceive = false;
+    completeCommand(SIM7000_OK);                                    // Don't wait for answer, let dispatcher set modem idle
 }
 
 /*!
@@ -865,7 +2652,7 @@ void FF_Sim7000::sendEOF(void) {
 
 */
 bool FF_Sim7000::needRestart(void){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     return restartNeeded;
 }
 
@@ -880,7 +2667,7 @@ bool FF_Sim7000::needRestart(void){
 
 */
 void FF_Sim7000::setRestart(bool restartFlag){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     restartNeeded = restartFlag;
 }
 
@@ -895,7 +2682,7 @@ void FF_Sim7000::setRestart(bool restartFlag){
 
 */
 bool FF_Sim7000::isIdle(void){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     return (gsmIdle == SIM7000_IDLE);
 }
 
@@ -910,7 +2697,7 @@ bool FF_Sim7000::isIdle(void){
 
 */
 bool FF_Sim7000::isSending(void){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     return (gsmIdle == SIM7000_SEND);
 }
 
@@ -925,7 +2712,7 @@ bool FF_Sim7000::isSending(void){
 
 */
 bool FF_Sim7000::isReceiving(void){
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     return (gsmIdle == SIM7000_RECV);
 }
 
@@ -938,36 +2725,38 @@ bool FF_Sim7000::isReceiving(void){
 
 */
 void FF_Sim7000::openModem(long baudRate) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     #ifdef FF_SIM7000_USE_SOFTSERIAL
         if (debugFlag) trace_debug_P("Opening modem at %d bds, rx=%d, tx=%d", baudRate, modemTxPin, modemRxPin);
         // Open modem at given speed
-        Sim7000Serial.begin(baudRate, SWSERIAL_8N1, modemTxPin, modemRxPin, false, MAX_ANSWER + 3); // Connect to Serial Software
+        modemSerial->begin(baudRate, SWSERIAL_8N1, modemTxPin, modemRxPin, false, answerSize + 3); // Connect to Serial Software
         // Enable TX interruption for speeds up to 19200 bds
-        Sim7000Serial.enableIntTx((baudRate <= 19200));
+        modemSerial->enableIntTx((baudRate <= 19200));
     #else
-        #if !defined(FF_SIM7000_USE_SERIAL1) && !defined(FF_SIM7000_USE_SERIAL2)
+        if (modemSerial == &Serial) {
             if (debugFlag) trace_debug_P("Opening modem at %d bds", baudRate);
-            Sim7000Serial.begin(baudRate, SERIAL_8N1);
+            modemSerial->begin(baudRate, SERIAL_8N1);
             // We're on Serial, disable debug output to be able to swap Serial to D8/D7
             #ifndef ESP32
-                Sim7000Serial.setDebugOutput(false);
-                Sim7000Serial.swap();
+                modemSerial->setDebugOutput(false);
+                modemSerial->swap();
             #endif
-        #else
+        } else {
             #ifdef ESP32
                 if (debugFlag) trace_debug_P("Opening modem at %d bds, rx=%d, tx=%d", baudRate, modemRxPin, modemTxPin);
-                Sim7000Serial.begin(baudRate, SERIAL_8N1, modemRxPin, modemTxPin);
-            #endif
-            #ifdef ESP8266
-                #error ESP8266 can only use Serial and SoftwareSerial, not SERIAL1 or Serial2!
+                modemSerial->begin(baudRate, SERIAL_8N1, modemRxPin, modemTxPin);
+            #else
+                if (debugFlag) trace_debug_P("Opening modem at %d bds", baudRate);
+                modemSerial->begin(baudRate, SERIAL_8N1);
             #endif
-        #endif
+        }
     #endif
     // Flush pending input chars
-    while (Sim7000Serial.available()) {
-        Sim7000Serial.read();
+    while (modemSerial->available()) {
+        modemSerial->read();
     }
+    rxPos = 0;
+    rxLen = 0;
     smsReady = false;
 }
 
@@ -992,7 +2781,7 @@ int FF_Sim7000::getRestartReason(void) {
 
 */
 void FF_Sim7000::waitUntilSmsReady(void) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     if (!smsReady) {
         waitSmsReady(30000, &FF_Sim7000::sendNextInitStep);
     } else {
@@ -1010,7 +2799,7 @@ void FF_Sim7000::waitUntilSmsReady(void) {
 
 */
 void FF_Sim7000::gotSca(void) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     // Extract SCA from message
     char* ptrStart;
     char scaNumber[MAX_SMS_NUMBER_LEN];
@@ -1041,7 +2830,8 @@ void FF_Sim7000::gotSca(void) {
         restartNeeded = true;
         return;
     }
-    strncpy(scaNumber, token, sizeof(scaNumber));
+    strncpy(scaNumber, token, sizeof(scaNumber)-1);
+    scaNumber[sizeof(scaNumber)-1] = 0;
     // Check SCA number (first char can be "+", all other should be digit)
     for (int i = 0; scaNumber[i]; i++) {
         // Is char not a number?
@@ -1056,11 +2846,270 @@ void FF_Sim7000::gotSca(void) {
         }
     }
     if (debugFlag) trace_debug_P("setting SCA to %s", scaNumber);
-    smsPdu.setSCAnumber(scaNumber);
+    smsTxPdu[0].setSCAnumber(scaNumber);
+    smsTxPdu[1].setSCAnumber(scaNumber);
+    strncpy(warmState.scaNumber, scaNumber, sizeof(warmState.scaNumber)-1);
+    warmState.scaNumber[sizeof(warmState.scaNumber)-1] = 0;
     resetLastAnswer();
     sendNextInitStep();
 }
 
+/*!
+
+    \brief  [Private] Check one line of warm start query answer
+
+    \param  none
+    \return true if line is consumed
+
+*/
+bool FF_Sim7000::checkWarmLine(void) {
+    if (!memcmp(lastAnswer, CSCA_INDICATOR, sizeof(CSCA_INDICATOR)-1)) {
+        // Answer format is +CSCA: "+33609001390",145
+        char* numberStart = strchr(lastAnswer, '"');
+        char* numberEnd = numberStart ? strchr(numberStart + 1, '"') : NULL;
+        if (numberEnd && (size_t) (numberEnd - numberStart - 1) == strlen(warmState.scaNumber)
+                && !memcmp(numberStart + 1, warmState.scaNumber, numberEnd - numberStart - 1)) {
+            warmMatchMask |= WARM_SCA_BIT;
+        }
+    } else {
+        uint8_t i = 0;
+        while (i < WARM_ANSWER_COUNT && strcmp(lastAnswer, warmAnswers[i])) {
+            i++;
+        }
+        if (i >= WARM_ANSWER_COUNT) {
+            return false;                                           // Not an answer to warm start query
+        }
+        warmMatchMask |= 1 << i;
+    }
+    if (debugFlag) trace_debug_P("Warm answer >%s<, mask %x", lastAnswer, warmMatchMask);
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Warm start: check modem config, running full init if it changed
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::gotWarmState(void) {
+    SIM7000_ENTER_ROUTINE();
+    inWarmQuery = false;
+    if (warmMatchMask == WARM_ALL) {
+        sendNextInitStep();
+        return;
+    }
+    trace_info_P("Modem config changed (mask %x), running full init", warmMatchMask);
+    stepTable = initSteps;
+    stepCount = STEP_SIZE;
+    stepPtr = INIT_STEP_AFTER_SPEED;                                // Modem already answered to AT and speed is set
+    sendCurrentInitStep();
+}
+
+/*!
+
+    \brief  [Private] Return speed to probe for a given index
+
+    Last used speed is tried first, then begin() one, then probeSpeeds ones (if autoBaud is set), skipping duplicates.
+
+    \param[in]  index: index of speed to probe
+    \return speed (bds), 0 if index is after last speed to probe
+
+*/
+long FF_Sim7000::getProbeSpeed(uint8_t index) {
+    long speed = 0;
+    uint8_t limit = autoBaud ? PROBE_SPEED_COUNT + 2 : 2;
+    for (uint8_t i = 0; i < limit; i++) {
+        speed = (i == 0) ? currentSpeed : (i == 1) ? modemSpeed : probeSpeeds[i - 2];
+        if (!speed || (i && speed == currentSpeed) || (i > 1 && speed == modemSpeed)) {
+            continue;                                               // Unknown or already tried
+        }
+        if (!index--) {
+            return speed;
+        }
+    }
+    return 0;
+}
+
+/*!
+
+    \brief  [Private] Modem initialization: send AT, looking for modem speed
+
+    Each speed returned by getProbeSpeed() is tried in turn (SIM7000_BAUD_PROBE_TIMEOUT ms each if autoBaud is set,
+        1 second else), up to SIM7000_BAUD_PROBE_COUNT times (10 if autoBaud is not set), as modem may still be booting.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::probeModemSpeed(void) {
+    SIM7000_ENTER_ROUTINE();
+    long speed = getProbeSpeed(probeIndex);
+    if (!speed) {                                                   // All speeds tried, restart list
+        probeIndex = 0;
+        speed = getProbeSpeed(0);
+    }
+    if (speed != currentSpeed) {
+        openModem(speed);
+        currentSpeed = speed;
+    }
+    probingSpeed = true;
+    sendCommand("AT", &FF_Sim7000::gotProbeAnswer, DEFAULT_ANSWER, autoBaud ? SIM7000_BAUD_PROBE_TIMEOUT : 1000);
+}
+
+/*!
+
+    \brief  [Private] Modem initialization: check answer to AT sent by probeModemSpeed()
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::gotProbeAnswer(void) {
+    SIM7000_ENTER_ROUTINE();
+    probingSpeed = false;
+    if (gsmStatus == SIM7000_OK) {
+        if (currentSpeed != modemSpeed) {
+            trace_info_P("Modem found at %d bds", currentSpeed);
+        }
+        sendNextInitStep();
+        return;
+    }
+    probeCount++;
+    if (probeCount >= (autoBaud ? SIM7000_BAUD_PROBE_COUNT : 10)) {
+        trace_error_P("No answer from modem after %d tries", probeCount);
+        gsmStatus = SIM7000_TIMEOUT;
+        restartNeeded = true;
+        restartReason = gsmStatus;
+        setIdle();
+        return;
+    }
+    probeIndex++;
+    probeModemSpeed();
+}
+
+/*!
+
+    \brief  [Private] Modem initialization: set modem speed
+
+    Modem is switched to begin() speed, or SIM7000_HIGH_SPEED if highSpeed is set (and test transfer didn't fail previously).
+        On warm start, nothing is sent if modem already uses this speed.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::setModemSpeed(void) {
+    SIM7000_ENTER_ROUTINE();
+    char tempBuffer[20];
+    targetSpeed = (highSpeed && !highSpeedFailed) ? SIM7000_HIGH_SPEED : modemSpeed;
+    if (stepTable == warmSteps && currentSpeed == targetSpeed) {
+        sendNextInitStep();
+        return;
+    }
+    if (debugFlag) trace_debug_P("Setting modem speed to %d bds", targetSpeed);
+    snprintf_P(tempBuffer, sizeof(tempBuffer), PSTR("AT+IPR=%ld"), targetSpeed);
+    sendCommand(tempBuffer, &FF_Sim7000::testModemSpeed);           // Modem answers at old speed
+}
+
+/*!
+
+    \brief  [Private] Modem initialization: switch serial to new modem speed, checking it if not begin() one
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::testModemSpeed(void) {
+    SIM7000_ENTER_ROUTINE();
+    if (currentSpeed != targetSpeed) {
+        modemSerial->flush();
+        openModem(targetSpeed);
+        currentSpeed = targetSpeed;
+    }
+    if (targetSpeed == modemSpeed) {                                // Requested speed, no need to check it
+        sendNextInitStep();
+        return;
+    }
+    speedTestCount = SIM7000_SPEED_TEST_COUNT;
+    sendSpeedTest();
+}
+
+/*!
+
+    \brief  [Private] Modem initialization: send a test transfer at negotiated speed
+
+    Command is echoed by modem at this step, and answer lines (echo included) are compared with first test ones
+        (through a hash), so data is checked in both ways.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::sendSpeedTest(void) {
+    SIM7000_ENTER_ROUTINE();
+    probingSpeed = true;
+    speedTestHash = 2166136261UL;                                   // FNV-1a offset basis
+    sendCommand("ATI;+CGMI;+CGMM;+CGMR;+CGSN", &FF_Sim7000::gotSpeedTest);
+}
+
+/*!
+
+    \brief  [Private] Modem initialization: check test transfer answer
+
+    First test answer lines are kept as reference. If test fails (or answer lines differ from reference),
+        modem speed is searched again, and set to begin() speed.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::gotSpeedTest(void) {
+    SIM7000_ENTER_ROUTINE();
+    probingSpeed = false;
+    if (gsmStatus == SIM7000_OK && speedTestCount == SIM7000_SPEED_TEST_COUNT) {
+        speedTestReference = speedTestHash;                         // First answer is reference for next ones
+    } else if (gsmStatus == SIM7000_OK && speedTestHash != speedTestReference) {
+        trace_warn_P("Test transfer answer differs from first one", NULL);
+        gsmStatus = SIM7000_BAD_ANSWER;
+    }
+    if (gsmStatus == SIM7000_OK) {
+        if (--speedTestCount) {
+            sendSpeedTest();
+            return;
+        }
+        trace_info_P("Modem speed set to %d bds", currentSpeed);
+        sendNextInitStep();
+        return;
+    }
+    trace_warn_P("Test transfer failed at %d bds, using %d bds", currentSpeed, modemSpeed);
+    highSpeedFailed = true;
+    speedTestCount = 0;
+    stepPtr = 0;
+    probeIndex = 0;
+    probeCount = 0;
+    resetLastAnswer();
+    sendCurrentInitStep();
+}
+
+/*!
+
+    \brief  [Private] Warm start: end of initialization
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::warmComplete(void) {
+    SIM7000_ENTER_ROUTINE();
+    if (debugFlag) trace_debug_P("setting SCA to %s", warmState.scaNumber);
+    smsTxPdu[0].setSCAnumber(warmState.scaNumber);
+    smsTxPdu[1].setSCAnumber(warmState.scaNumber);
+    initComplete();
+}
+
 /*!
 
     \brief  [Private] Modem initialization: end of initialization
@@ -1070,13 +3119,16 @@ void FF_Sim7000::gotSca(void) {
 
 */
 void FF_Sim7000::initComplete(void) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     if (gsmStatus) {
         restartNeeded = true;
         restartReason = gsmStatus;
     } else {
+        warmState.magic = SIM7000_WARM_MAGIC;                       // Next restart may be a warm one
         setIdle();
         trace_info_P("SMS gateway started, restart count = %d", restartCount);
+        modemReady = true;
+        notifyStatus(SIM7000_STATUS_READY, restartCount);
         restartCount++;
     }
 }
@@ -1090,32 +3142,49 @@ void FF_Sim7000::initComplete(void) {
 
 */
 void FF_Sim7000::sendSMStext(void) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
 
-    if (debugFlag) trace_debug_P("Message: %s", smsPdu.getSMS());
-    Sim7000Serial.write(smsPdu.getSMS());
+    if (debugFlag) trace_debug_P("Message: %s", smsTxPdu[txPduIndex].getSMS());
+    writeModem(smsTxPdu[txPduIndex].getSMS());
     sendCommand(0x1a, &FF_Sim7000::sendNextSmsChunk, "+CMGS:", 60000);
+    prepareNextSmsChunk();                                          // Encode next chunk while waiting for confirmation
+}
+
+/*!
+
+    \brief  [Private] Wait for SMS ready message a given time
+
+    \param[in]  waitMs: Time (ms) to wait for SMS ready message
+    \param[in]  nextStep: Routine to call as next step in sequence
+    \return none
+
+*/
+void FF_Sim7000::waitSmsReady(unsigned long waitMs, void (FF_Sim7000::*nextStep)(void)) {
+    SIM7000_ENTER_ROUTINE();
+    if (debugFlag) trace_debug_P("Waiting SMS Ready for %d ms", waitMs);
+    gsmTimeout = waitMs;
+    gsmStatus = SIM7000_RUNNING;
+    nextStepCb = nextStep;
+    startTime = millis();
+    cmdState = SIM7000_CMD_SMS_READY;
 }
 
 /*!
 
-    \brief  [Private] Wait for SMS ready message a given time
+    \brief  [Private] Wait a given time
 
-    \param[in]  waitMs: Time (ms) to wait for SMS ready message
+    \param[in]  waitMs: Time (ms) to wait
     \param[in]  nextStep: Routine to call as next step in sequence
     \return none
 
 */
-void FF_Sim7000::waitSmsReady(unsigned long waitMs, void (FF_Sim7000::*nextStep)(void)) {
-    if (traceFlag) enterRoutine(__func__);
-    if (debugFlag) trace_debug_P("Waiting SMS Ready for %d ms", waitMs);
+void FF_Sim7000::waitDelay(unsigned long waitMs, void (FF_Sim7000::*nextStep)(void)) {
+    SIM7000_ENTER_ROUTINE();
     gsmTimeout = waitMs;
     gsmStatus = SIM7000_RUNNING;
     nextStepCb = nextStep;
     startTime = millis();
-    inReceive = false;
-    inWait = true;
-    inWaitSmsReady = true;
+    cmdState = SIM7000_CMD_DELAY;
 }
 
 /*!
@@ -1130,30 +3199,36 @@ void FF_Sim7000::waitSmsReady(unsigned long waitMs, void (FF_Sim7000::*nextStep)
 
 */
 void FF_Sim7000::sendCommand(const char *command, void (FF_Sim7000::*nextStep)(void), const char *resp, unsigned long cdeTimeout, uint8_t repeat) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     commandCount++;
     gsmTimeout = cdeTimeout;
     gsmStatus = SIM7000_RUNNING;
     nextStepCb = nextStep;
-    stepMaxRepeatcount = repeat;
-    strncpy(expectedAnswer, resp, sizeof(expectedAnswer));
+    cmdRetries = repeat;
+    strncpy(expectedAnswer, resp, sizeof(expectedAnswer)-1);
+    expectedAnswer[sizeof(expectedAnswer)-1] = 0;
+    expectedLength = strlen(expectedAnswer);
+    isDefaultAnswer = !strcmp(expectedAnswer, DEFAULT_ANSWER);
     if (debugFlag) trace_debug_P("Issuing command: %s", command);
     // Send command if defined (else, we'll just wait for answer of a previously sent command)
     if (command[0]) {
-        // Is this a new command?
-        if (strcmp(lastCommand, command)) {
-            // Yes, reset repeat count
-            stepRepeatCount = 0;
+        strncpy(lastCommand, command, sizeof(lastCommand)-1);       // Save last command
+        lastCommand[sizeof(lastCommand)-1] = 0;
+        if (gsmIdle == SIM7000_STARTING) {                          // Set command class for metrics
+            commandClass = SIM7000_CLASS_INIT;
+        } else if (!strncmp(command, "AT+CMGS=", 8)) {
+            commandClass = SIM7000_CLASS_CMGS_PROMPT;
+        } else if (!strncmp(command, "AT+CMGD=", 8)) {
+            commandClass = SIM7000_CLASS_CMGD;
+        } else {
+            commandClass = SIM7000_CLASS_OTHER;
         }
-        strncpy(lastCommand, command, sizeof(lastCommand));         // Save last command
         resetLastAnswer();
-        Sim7000Serial.write(command);
-        Sim7000Serial.write('\r');
+        writeModem(command);
+        writeModem("\r");
     }
     startTime = millis();
-    inReceive = true;
-    inWait = false;
-    inWaitSmsReady = false;
+    cmdState = SIM7000_CMD_ANSWER;
     nextLineIsSmsMessage = false;
 }
 
@@ -1169,18 +3244,22 @@ void FF_Sim7000::sendCommand(const char *command, void (FF_Sim7000::*nextStep)(v
 
 */
 void FF_Sim7000::sendCommand(const uint8_t command, void (FF_Sim7000::*nextStep)(void), const char *resp, unsigned long cdeTimeout) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     commandCount++;
     gsmTimeout = cdeTimeout;
     gsmStatus = SIM7000_RUNNING;
     nextStepCb = nextStep;
-    strncpy(expectedAnswer, resp, sizeof(expectedAnswer));
+    strncpy(expectedAnswer, resp, sizeof(expectedAnswer)-1);
+    expectedAnswer[sizeof(expectedAnswer)-1] = 0;
+    expectedLength = strlen(expectedAnswer);
+    isDefaultAnswer = !strcmp(expectedAnswer, DEFAULT_ANSWER);
     resetLastAnswer();
     if (debugFlag) trace_debug_P("Issuing command: 0x%x", command);
-    Sim7000Serial.write(command);
+    commandClass = (command == 0x1a) ? SIM7000_CLASS_CMGS_CONFIRM : SIM7000_CLASS_OTHER;
+    writeModem((const char*) &command, 1);
     startTime = millis();
-    inReceive = true;
-    inWaitSmsReady = false;
+    cmdRetries = 0;
+    cmdState = SIM7000_CMD_ANSWER;
 }
 
 /*!
@@ -1192,18 +3271,20 @@ void FF_Sim7000::sendCommand(const uint8_t command, void (FF_Sim7000::*nextStep)
 
 */
 void FF_Sim7000::setIdle(void) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
     trace_debug_P("Modem is idle", NULL);
     gsmIdle = SIM7000_IDLE;
-    inReceive = false;
+    cmdState = SIM7000_CMD_NONE;
     resetLastAnswer();
 }
 
+#if FF_SIM7000_LOG_LEVEL >= SIM7000_LOG_TRACE
 /*!
 
     \brief  [Private] Debug: trace each entered routine
 
     By default, do nothing as very verbose. Enable it only when really needed.
+        Only compiled when FF_SIM7000_LOG_LEVEL keeps entered routines traces.
 
     \param[in]  routine name to display
     \return none
@@ -1212,29 +3293,25 @@ void FF_Sim7000::setIdle(void) {
 void FF_Sim7000::enterRoutine(const char* routineName) {
     if (traceEnterFlag) trace_debug_P("Entering %s", routineName);
 }
+#endif
 
 /*!
 
     \brief  [Private] Read a SMS header
 
-    \param[in]  msg: modem answer
+    \param  none
     \return none
 
 */
-void FF_Sim7000::readSmsHeader(const char* msg) {
-    if (traceFlag) enterRoutine(__func__);
+void FF_Sim7000::readSmsHeader(void) {
+    SIM7000_ENTER_ROUTINE();
     index = 0;
 
     // Answer format is:
     // +CMT ,33
     // 07913396050066F0040B913306672146F00000328041102270800FCDF27C1E3E9741E432885E9ED301
 
-    // Parse the response if it contains a valid SMS_INDICATOR
-    char* ptrStart = strstr(msg, SMS_INDICATOR);
-    if (ptrStart == NULL) {
-        trace_error_P("Can't find %s in %s", SMS_INDICATOR, msg);
-        return;
-    }
+    // Line is known to start with SMS_INDICATOR (see urcTable)
     if (debugFlag) trace_debug_P("Waiting for SMS", NULL);
     nextLineIsSmsMessage = true;
 }
@@ -1248,41 +3325,290 @@ void FF_Sim7000::readSmsHeader(const char* msg) {
 
 */
 void FF_Sim7000::readSmsMessage(const char* msg) {
-    if (traceFlag) enterRoutine(__func__);
+    SIM7000_ENTER_ROUTINE();
+    if (deferCallbacks) {
+        // Keep PDU, it'll be decoded by dispatchEvents()
+        if (!eventQueue.push(EVENT_SMS_RECEIVED, msg)) {
+            trace_error_P("Event queue full, dropping SMS PDU >%s<", msg);
+        }
+    } else {
+        decodeSmsMessage(msg);
+    }
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+        if (inDrain) {                                              // Messages will be deleted at end of list
+            drainReadCount++;
+            return;
+        }
+    #endif
+    cleanupReceivedSms();
+}
+
+/*!
+
+    \brief  [Private] Acknowledge or cleanup after a received SMS, depending on ackSms and cleanupPolicy
+
+    If SMS has been received while a command was running, acknowledge or cleanup command is queued,
+        to be sent once modem is idle, and running command goes on.
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::cleanupReceivedSms(void) {
+    if (smsDuringCommand) {
+        smsDuringCommand = false;
+        if (ackSms) {
+            queueCommand("AT+CNMA");
+        } else if (cleanupPolicy == SIM7000_CLEANUP_IMMEDIATE) {
+            queueCommand("AT+CMGD=1,2", NULL, DEFAULT_ANSWER, 20000);
+        } else if (cleanupPolicy == SIM7000_CLEANUP_DEFERRED) {
+            cleanupPending = true;
+            lastSmsTime = millis();
+        }
+        return;
+    }
+    if (ackSms) {                                                   // Acknowledge only, message is not stored
+        gsmIdle = SIM7000_RECV;
+        sendCommand("AT+CNMA", &FF_Sim7000::setIdle);
+        return;
+    }
+    if (cleanupPolicy == SIM7000_CLEANUP_IMMEDIATE) {
+        gsmIdle = SIM7000_RECV;
+        deleteSMS(1,2);
+        return;
+    }
+    if (cleanupPolicy == SIM7000_CLEANUP_DEFERRED) {
+        cleanupPending = true;                                      // Will be done by doLoop()
+        lastSmsTime = millis();
+    }
+    setIdle();
+}
+
+/*!
+
+    \brief  [Private] Decode a PDU containing a received SMS and give it to SMS callback
+
+    \param[in]  msg: received PDU
+    \return none
+
+*/
+void FF_Sim7000::decodeSmsMessage(const char* msg) {
+    SIM7000_ENTER_ROUTINE();
     if (smsPdu.decodePDU(msg)) {
         if (smsPdu.getOverflow()) {
             trace_warn_P("SMS decode overflow, partial message only", NULL);
         }
-        lastReceivedNumber = String(smsPdu.getSender());
-        lastReceivedDate = String(smsPdu.getTimeStamp());
-        lastReceivedMessage = String(smsPdu.getText());
-        smsForwardedCount++;
-        if (debugFlag) trace_debug_P("Got SMS from %s, sent at %s, >%s<", lastReceivedNumber.c_str(), lastReceivedDate.c_str(), lastReceivedMessage.c_str());
-        if (readSmsCb) (*readSmsCb)(lastReceivedNumber.c_str(), lastReceivedDate.c_str(), lastReceivedMessage.c_str());
+        smsReadCount++;
+        #if SIM7000_REASSEMBLY_SLOTS > 0
+            int* concatInfo = smsPdu.getConcatInfo();               // Reference, part number and total parts (0 if not multi-part)
+            if (concatInfo[2] > 1) {
+                reassembleSms(smsPdu.getSender(), smsPdu.getTimeStamp(), smsPdu.getText(), concatInfo[0], concatInfo[1], concatInfo[2]);
+                return;
+            }
+        #endif
+        deliverSms(smsPdu.getSender(), smsPdu.getTimeStamp(), smsPdu.getText());
     } else {
         trace_error_P("SMS PDU decode failed", NULL);
     }
-    deleteSMS(1,2);
 }
 
 /*!
 
-    \brief  [Private] Clean ast answer
+    \brief  [Private] Save a received SMS and give it to SMS callback
+
+    \param[in]  number: phone number of SMS sender
+    \param[in]  date: date of SMS
+    \param[in]  message: SMS text (UTF-8)
+    \return none
+
+*/
+void FF_Sim7000::deliverSms(const char* number, const char* date, const char* message) {
+    SET_FIELD(lastReceivedNumber, number);
+    SET_FIELD(lastReceivedDate, date);
+    SET_FIELD(lastReceivedMessage, message);
+    smsForwardedCount++;
+    if (debugFlag) trace_debug_P("Got SMS from %s, sent at %s, >%s<", FIELD_STR(lastReceivedNumber), FIELD_STR(lastReceivedDate), FIELD_STR(lastReceivedMessage));
+    if (readSmsCb) (*readSmsCb)(FIELD_STR(lastReceivedNumber), FIELD_STR(lastReceivedDate), FIELD_STR(lastReceivedMessage));
+}
+
+#if SIM7000_REASSEMBLY_SLOTS > 0
+/*!
+
+    \brief  [Private] Store one part of a multi-part received SMS, delivering full message when all parts are received
+
+    Slots are keyed by sender, reference and total parts. When no slot is free, the oldest one is dropped.
+
+    \param[in]  number: phone number of SMS sender
+    \param[in]  date: date of SMS part
+    \param[in]  message: SMS part text (UTF-8)
+    \param[in]  reference: concatenated SMS reference
+    \param[in]  part: part number (starting at 1)
+    \param[in]  total: total count of parts
+    \return none
+
+*/
+void FF_Sim7000::reassembleSms(const char* number, const char* date, const char* message, uint16_t reference, uint8_t part, uint8_t total) {
+    SIM7000_ENTER_ROUTINE();
+    if (debugFlag) trace_debug_P("Got part %d/%d of SMS %d from %s", part, total, reference, number);
+    if (part < 1 || part > total || total > SIM7000_REASSEMBLY_PARTS) {
+        trace_error_P("Can't reassemble part %d/%d of SMS from %s, delivering it alone", part, total, number);
+        deliverSms(number, date, message);
+        return;
+    }
+    // Look for this message slot, or a free one, or the oldest one
+    FF_Sim7000ReassemblySlot* slot = NULL;
+    FF_Sim7000ReassemblySlot* freeSlot = NULL;
+    FF_Sim7000ReassemblySlot* oldestSlot = &reassemblySlot[0];
+    for (uint8_t i = 0; i < SIM7000_REASSEMBLY_SLOTS; i++) {
+        FF_Sim7000ReassemblySlot* current = &reassemblySlot[i];
+        if (current->inUse) {
+            if (current->reference == reference && current->total == total && !strncmp(current->sender, number, sizeof(current->sender)-1)) {
+                slot = current;
+                break;
+            }
+            if (oldestSlot->inUse && (long) (current->startTime - oldestSlot->startTime) < 0) {
+                oldestSlot = current;
+            }
+        } else if (!freeSlot) {
+            freeSlot = current;
+        }
+    }
+    if (!slot) {
+        slot = freeSlot;
+        if (!slot) {
+            trace_warn_P("No free reassembly slot, dropping SMS %d from %s", oldestSlot->reference, oldestSlot->sender);
+            metrics.reassemblyDropCount++;
+            slot = oldestSlot;
+        }
+        // Init slot for this message
+        memset(slot, 0, offsetof(FF_Sim7000ReassemblySlot, text));
+        slot->inUse = true;
+        strncpy(slot->sender, number, sizeof(slot->sender)-1);
+        strncpy(slot->date, date, sizeof(slot->date)-1);
+        slot->reference = reference;
+        slot->total = total;
+        slot->startTime = millis();
+    }
+    uint32_t partBit = 1UL << (part - 1);
+    if (slot->receivedMask & partBit) {
+        if (debugFlag) trace_debug_P("Part %d of SMS %d already received", part, reference);
+        return;
+    }
+    // Save part text
+    size_t partLength = strlen(message);
+    if (slot->textLength + partLength > sizeof(slot->text)) {
+        trace_warn_P("SMS %d from %s is too long to be reassembled, dropping it", reference, number);
+        metrics.reassemblyDropCount++;
+        slot->inUse = false;
+        return;
+    }
+    memcpy(slot->text + slot->textLength, message, partLength);
+    slot->partOffset[part-1] = slot->textLength;
+    slot->partLength[part-1] = partLength;
+    slot->textLength += partLength;
+    slot->receivedMask |= partBit;
+    slot->receivedCount++;
+    if (part == 1) {                                                // Use date of first part
+        strncpy(slot->date, date, sizeof(slot->date)-1);
+    }
+    // Are all parts received?
+    if (slot->receivedCount == slot->total) {
+        size_t length = 0;
+        for (uint8_t i = 0; i < slot->total; i++) {
+            memcpy(reassembledText + length, slot->text + slot->partOffset[i], slot->partLength[i]);
+            length += slot->partLength[i];
+        }
+        reassembledText[length] = 0;
+        slot->inUse = false;
+        metrics.reassembledCount++;
+        deliverSms(slot->sender, slot->date, reassembledText);
+    }
+}
+
+/*!
+
+    \brief  [Private] Drop multi-part received SMS not fully received after SIM7000_REASSEMBLY_TIMEOUT
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::checkReassemblyTimeout(void) {
+    for (uint8_t i = 0; i < SIM7000_REASSEMBLY_SLOTS; i++) {
+        FF_Sim7000ReassemblySlot* slot = &reassemblySlot[i];
+        if (slot->inUse && (millis() - slot->startTime) >= SIM7000_REASSEMBLY_TIMEOUT) {
+            trace_warn_P("Only %d parts of %d received for SMS %d from %s, dropping it", slot->receivedCount, slot->total, slot->reference, slot->sender);
+            metrics.reassemblyDropCount++;
+            slot->inUse = false;
+        }
+    }
+}
+#endif
+
+/*!
+
+    \brief  Dispatch deferred events
+
+    When deferCallbacks is set, received SMS, sent SMS, unknown lines and status changes are only saved by doLoop(). This routine should then be called
+        by application (when it has time to do so) to decode them and call callbacks.
+
+    Received SMS decoding and multi-part reassembly (including its time-out) are only done here, so that they never run
+        in modem task.
+
+    \param  none
+    \return count of dispatched events
+
+*/
+uint16_t FF_Sim7000::dispatchEvents(void) {
+    SIM7000_ENTER_ROUTINE();
+    uint16_t eventCount = 0;
+    #if SIM7000_REASSEMBLY_SLOTS > 0
+        checkReassemblyTimeout();
+    #endif
+    char* type;
+    while ((type = eventQueue.front()) != NULL) {
+        char* data = type + strlen(type) + 1;                       // First data string is just after type
+        if (!strcmp(type, EVENT_SMS_RECEIVED)) {
+            decodeSmsMessage(data);
+        } else if (!strcmp(type, EVENT_SMS_SENT)) {
+            char* date = data + strlen(data) + 1;
+            char* message = date + strlen(date) + 1;
+            if (sendSmsCb) (*sendSmsCb)(data, date, message);
+        } else if (!strcmp(type, EVENT_LINE)) {
+            if (recvLineCb) (*recvLineCb)(data);
+        } else if (!strcmp(type, EVENT_STATUS)) {
+            char* reason = data + strlen(data) + 1;
+            if (statusCb) (*statusCb)(atoi(data), atoi(reason));
+        }
+        eventQueue.pop();
+        eventCount++;
+    }
+    return eventCount;
+}
+
+/*!
+
+    \brief  [Private] Clean last answer
+
+    Only write index is reset, lastAnswer being zero terminated when a line is complete.
 
     \param  none
     \return none
 
 */
 void FF_Sim7000::resetLastAnswer(void) {
-    if (traceFlag) enterRoutine(__func__);
-    memset(lastAnswer, 0, sizeof(lastAnswer));
+    SIM7000_ENTER_ROUTINE();
+    answerLen = 0;
+    lastAnswer[0] = 0;
+    urcCandidates = URC_ALL;
+    urcMatch = URC_COUNT;
 }
 
 /*!
 
     \brief  Return GSM7 equivalent length of one UTF-8 character
 
-    This routine takes one UTF-8 character coded on up-to 3 bytes to return it's length when coded in GSM7
+    This routine takes one UTF-8 character coded on up-to 3 bytes to return it's length when coded in GSM7, using utf8Class table
 
     \param[in]  c1: first byte of UTF-8 character to analyze
     \param[in]  c2: second byte of UTF-8 character to analyze (or zero if end of message)
@@ -1292,81 +3618,365 @@ void FF_Sim7000::resetLastAnswer(void) {
 */
 
 uint8_t FF_Sim7000::getGsm7EquivalentLen(const uint8_t c1, const uint8_t c2, const uint8_t c3) {
-    if (
-            // These are one byte UTF8 char coded on one byte GSM7 char
-            (c1 == 0x0a)    /* Linefeed */                                                                                      ||
-            (c1 == 0x0d)    /* Carriage return */                                                                               ||
-            (c1 >= 0x20     /* Space */                                 && c1 <= 0x5a) /* Capital letter Z */                   ||
-            (c1 == 0x5f)    /* Underscore */                                                                                    ||
-            (c1 >= 0x61     /* Small letter a */                        && c1 <= 0x7a) /* Small letter z */
-        ) {
+    switch (UTF8_GSM7_CLASS(utf8Class[c1])) {
+        case UTF8_GSM7:
             return 1;
-    }
-    if ((c1 == 0xc2) && (
-            // These are two bytes UTF8 char coded on one byte GSM7 char
-            (c2 == 0xa1)    /* Inverted exclamation mark */                                                                     ||
-            (c2 >= 0xa3     /* Pound sign */                            && c2 <= 0xa5) /* Yuan/Yen sign */                      ||
-            (c2 == 0xa7)    /* Section sign */                                                                                  ||
-            (c2 == 0xbf)    /* Inverted question mark */
-        )) {
-            return 1;
-    }
-    if ((c1 == 0xc3) && (
-            // These are two bytes UTF8 char coded on one byte GSM7 char
-            (c2 >= 0x84     /* Capital letter A with diaeresis */       && c2 <= 0x87) /* Capital letter C with cedilla */      ||
-            (c2 == 0x89)    /* Capital letter E with acute accent */                                                            ||
-            (c2 == 0x91)    /* Capital letter N with tilde */                                                                   ||
-            (c2 == 0x96)    /* Capital letter O with diaeresis */                                                               ||
-            (c2 == 0x98)    /* Capital letter O with stroke */                                                                  ||
-            (c2 == 0x9c)    /* Capital letter U with diaeresis */                                                               ||
-            (c2 >= 0x9f     /* Small letter German Eszett */            && c2 <= 0xa0) /* Small letter a with grave accent */   ||
-            (c2 >= 0xa4     /* Small letter a with diaeresis */         && c2 <= 0xa6) /* Small letter ae */                    ||
-            (c2 >= 0xa8     /* Small letter e with grave accent */      && c2 <= 0xa9) /* Small letter e with acute accent */   ||
-            (c2 == 0xac)    /* Small letter i with grave accent */                                                              ||
-            (c2 >= 0xb1     /* Small letter n with tilde */             && c2 <= 0xb2) /* Small letter o with grave accent */   ||
-            (c2 == 0xb6)    /* Small letter o with diaeresis */                                                                 ||
-            (c2 >= 0xb8     /* Small letter o with stroke */            && c2 <= 0xb9) /* Small letter u with grave accent */   ||
-            (c2 == 0xbc)    /* Small letter u with diaeresis */
-        )) {
-            return 1;
-    }
-    if (
-            // These are one byte UTF8 char coded on two bytes GSM7 char
-            (c1 == 0x0c)    /* Form feed */ ||
-            (c1 >= 0x5b     /* Left square bracket */                   && c1 <= 0x5e) /* Caret / Circumflex */                 ||
-            (c1 >= 0x7b     /* Left curly bracket */                    && c1 <= 0x7e) /* Tilde */
-        ) {
+        case UTF8_GSM7_ESCAPE:
             return 2;
-    }
-    if (c1 == 0xe2 &&
-            // This is three bytes UTF8 char coded on two bytes GSM7 char
-            c2 == 0x82 &&
-            c3 == 0xac      /* Euro sign */
-        ) {
-        return 2;
+        case UTF8_CHECK_C2:
+            return UTF8_IN_MAP(utf8C2Map, c2) ? 1 : 0;
+        case UTF8_CHECK_C3:
+            return UTF8_IN_MAP(utf8C3Map, c2) ? 1 : 0;
+        case UTF8_CHECK_E2:
+            return (c2 == 0x82 && c3 == 0xac) ? 2 : 0;              // Euro sign
     }
     return 0;
 }
 
 /*!
 
-    \brief  Return UCS-2 equivalent length of one UTF-8 character
+    \brief  Prepare sending of an UTF-8 message
 
-    This routine takes one UTF-8 message to return it's length when coded in UCS-2
+    This routine scans message once, one UTF-8 character (not byte) at a time, to determine:
+        - message encoding (GSM7 if all characters are in GSM7 table, UCS-2 else),
+        - message length (in GSM7 septets or UCS-2 16 bits characters),
+        - chunk count and byte offset of each chunk (chunks are cut on character boundaries).
+
+    Chunks are computed for both encodings during scan, as encoding is only known at end of message.
+        When message needs more than SIM7000_MAX_SMS_CHUNKS chunks, it's truncated.
 
     \param[in]  text: message to be scanned
-    \return Length of character when coded in UCS-2
+    \param[out]  plan: message plan to fill
+    \return none
 
 */
+void FF_Sim7000::planMessage(const char* text, FF_Sim7000MessagePlan* plan) {
+    const uint8_t* ptr = (const uint8_t*) text;
+    uint16_t gsm7Count = 0;                                         // Total GSM7 septets
+    uint16_t ucs2Count = 0;                                         // Total UCS-2 characters
+    uint16_t gsm7ChunkCount = 0;                                    // GSM7 septets in current chunk
+    uint16_t ucs2ChunkCount = 0;                                    // UCS-2 characters in current chunk
+    uint16_t gsm7Offset[SIM7000_MAX_SMS_CHUNKS+1];                  // GSM7 chunk offsets
+    uint16_t ucs2Offset[SIM7000_MAX_SMS_CHUNKS+1];                  // UCS-2 chunk offsets
+    uint8_t gsm7Chunks = 1;                                         // Count of GSM7 chunks
+    uint8_t ucs2Chunks = 1;                                         // Count of UCS-2 chunks
+    uint16_t gsm7End = 0;                                           // End of last GSM7 chunk (if message is truncated)
+    uint16_t ucs2End = 0;                                           // End of last UCS-2 chunk (if message is truncated)
+    bool isGsm7 = true;
+
+    gsm7Offset[0] = 0;
+    ucs2Offset[0] = 0;
+    while (*ptr) {
+        uint16_t offset = ptr - (const uint8_t*) text;
+        uint8_t sequenceLength = UTF8_SEQUENCE_LENGTH(utf8Class[*ptr]);
+        // Stop sequence on end of message
+        for (uint8_t i = 1; i < sequenceLength; i++) {
+            if (!ptr[i]) {
+                sequenceLength = i;
+                break;
+            }
+        }
+        if (isGsm7) {
+            uint8_t septets = getGsm7EquivalentLen(ptr[0], sequenceLength > 1 ? ptr[1] : 0, sequenceLength > 2 ? ptr[2] : 0);
+            if (septets) {
+                gsm7Count += septets;
+                // Start a new chunk if this character doesn't fit in current one
+                if (gsm7ChunkCount + septets > SIM7000_GSM7_CHUNK) {
+                    if (gsm7Chunks < SIM7000_MAX_SMS_CHUNKS) {
+                        gsm7Offset[gsm7Chunks++] = offset;
+                    } else if (!gsm7End) {
+                        gsm7End = offset;
+                    }
+                    gsm7ChunkCount = 0;
+                }
+                gsm7ChunkCount += septets;
+            } else {
+                if (debugFlag) trace_info_P("Switched to UCS-2 on char 0x%02x at pos %d", ptr[0], offset);
+                isGsm7 = false;
+            }
+        }
+        uint8_t ucs2Chars = (sequenceLength == 4) ? 2 : 1;          // 4 bytes UTF-8 are coded as UTF-16 surrogate pair
+        ucs2Count += ucs2Chars;
+        if (ucs2ChunkCount + ucs2Chars > SIM7000_UCS2_CHUNK) {
+            if (ucs2Chunks < SIM7000_MAX_SMS_CHUNKS) {
+                ucs2Offset[ucs2Chunks++] = offset;
+            } else if (!ucs2End) {
+                ucs2End = offset;
+            }
+            ucs2ChunkCount = 0;
+        }
+        ucs2ChunkCount += ucs2Chars;
+        ptr += sequenceLength;
+    }
+    uint16_t utf8Length = ptr - (const uint8_t*) text;
+    // Keep plan of selected encoding
+    plan->isGsm7 = isGsm7;
+    if (isGsm7) {
+        plan->length = gsm7Count;
+        plan->chunkCount = (gsm7Count > SIM7000_GSM7_SINGLE) ? gsm7Chunks : 0;
+        memcpy(plan->chunkOffset, gsm7Offset, gsm7Chunks * sizeof(gsm7Offset[0]));
+        plan->chunkOffset[gsm7Chunks] = gsm7End ? gsm7End : utf8Length;
+        plan->isTruncated = gsm7End != 0;
+    } else {
+        plan->length = ucs2Count;
+        plan->chunkCount = (ucs2Count > SIM7000_UCS2_SINGLE) ? ucs2Chunks : 0;
+        memcpy(plan->chunkOffset, ucs2Offset, ucs2Chunks * sizeof(ucs2Offset[0]));
+        plan->chunkOffset[ucs2Chunks] = ucs2End ? ucs2End : utf8Length;
+        plan->isTruncated = ucs2End != 0;
+    }
+    // Single message holds the full text
+    if (!plan->chunkCount) {
+        plan->chunkOffset[1] = utf8Length;
+    }
+}
+
+/*!
 
+    \brief  Return length of an UTF-8 message when coded in UCS-2
+
+    Characters are counted as planMessage() does, 4 bytes UTF-8 characters being coded as UTF-16 surrogate pair.
+
+    \param[in]  text: message to be scanned
+    \return Message length in UCS-2 16 bits characters (not bytes)
+
+*/
 uint16_t FF_Sim7000::ucs2MessageLength(const char* text) {
-    uint16_t utf8CharCount = 0;
+    const uint8_t* ptr = (const uint8_t*) text;
+    uint16_t ucs2Count = 0;
+
+    while (*ptr) {
+        uint8_t sequenceLength = UTF8_SEQUENCE_LENGTH(utf8Class[*ptr]);
+        // Stop sequence on end of message
+        for (uint8_t i = 1; i < sequenceLength; i++) {
+            if (!ptr[i]) {
+                sequenceLength = i;
+                break;
+            }
+        }
+        ucs2Count += (sequenceLength == 4) ? 2 : 1;
+        ptr += sequenceLength;
+    }
+    return ucs2Count;
+}
+
+/*!
+
+    \brief  [Private] Update metrics at end of command
+
+    \param[in]  status: command status (SIM7000_OK, SIM7000_TIMEOUT or SIM7000_CM_ERROR)
+    \return none
+
+*/
+void FF_Sim7000::recordCommand(int status) {
+    FF_Sim7000CommandMetrics &commandMetrics = metrics.command[commandClass];
+    if (status == SIM7000_OK) {
+        histogramAdd(commandMetrics.latency, millis() - startTime);
+        if (commandClass == SIM7000_CLASS_CMGS_CONFIRM) {
+            uint32_t chunkMs = millis() - chunkStartTime;
+            histogramAdd(inBatch ? metrics.batchChunkSend : metrics.chunkSend, chunkMs);
+            recentLatency = recentLatency ? (recentLatency * 7 + chunkMs) / 8 : chunkMs;
+        }
+    } else if (status == SIM7000_CM_ERROR) {
+        commandMetrics.errorCount++;
+    } else {
+        commandMetrics.timeoutCount++;
+    }
+}
+
+/*!
+
+    \brief  Return modem metrics
+
+    Metrics contain latency histograms and time-out/error counts per command class, SMS chunk and full SMS send time.
+
+    \param  none
+    \return reference to metrics structure (updated by doLoop())
+
+*/
+const FF_Sim7000Metrics& FF_Sim7000::getMetrics(void) {
+    return metrics;
+}
+
+/*!
+
+    \brief  Reset modem metrics
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::resetMetrics(void) {
+    memset(&metrics, 0, sizeof(metrics));
+}
+
+/*!
+
+    \brief  [Private] Poll signal quality, system information and network registration
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::pollTelemetry(void) {
+    SIM7000_ENTER_ROUTINE();
+    lastTelemetryTime = millis();
+    pendingSample.time = lastTelemetryTime;
+    pendingSample.csq = SIM7000_CSQ_UNKNOWN;
+    pendingSample.ber = SIM7000_CSQ_UNKNOWN;
+    pendingSample.rat = SIM7000_RAT_UNKNOWN;
+    inTelemetry = true;
+    sendCommand("AT+CSQ;+CPSI?;" CREG_QUERY, &FF_Sim7000::telemetryComplete);
+}
+
+/*!
+
+    \brief  [Private] Handle signal quality answer (+CSQ: <rssi>,<ber>)
+
+    \param  none
+    \return true if line is consumed, false if not polling
+
+*/
+bool FF_Sim7000::gotCsq(void) {
+    if (!inTelemetry) {
+        return false;
+    }
+    char* end;
+    pendingSample.csq = strtol(lastAnswer + sizeof(CSQ_INDICATOR) - 1, &end, 10);
+    if (*end == ',') {
+        pendingSample.ber = strtol(end + 1, NULL, 10);
+    }
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] Handle system information answer (+CPSI: <system mode>,<operation mode>,...)
+
+    \param  none
+    \return true if line is consumed, false if not polling
+
+*/
+bool FF_Sim7000::gotCpsi(void) {
+    if (!inTelemetry) {
+        return false;
+    }
+    const char* ptrStr = lastAnswer + sizeof(CPSI_INDICATOR) - 1;
+    if (!strncmp(ptrStr, "NO SERVICE", 10)) {
+        pendingSample.rat = SIM7000_RAT_NONE;
+    } else if (!strncmp(ptrStr, "GSM", 3)) {
+        pendingSample.rat = SIM7000_RAT_GSM;
+    } else if (!strncmp(ptrStr, "LTE CAT-M1", 10)) {
+        pendingSample.rat = SIM7000_RAT_CAT_M1;
+    } else if (!strncmp(ptrStr, "LTE NB-IOT", 10)) {
+        pendingSample.rat = SIM7000_RAT_NB_IOT;
+    }
+    resetLastAnswer();
+    return true;
+}
+
+/*!
+
+    \brief  [Private] End of signal/registration poll: save sample
+
+    Sample is saved even if poll failed (values not received stay unknown).
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000::telemetryComplete(void) {
+    SIM7000_ENTER_ROUTINE();
+    inTelemetry = false;
+    if (gsmStatus != SIM7000_OK) {
+        trace_warn_P("Signal poll failed (status %d)", gsmStatus);
+    }
+    pendingSample.regState = regState;
+    telemetrySample[telemetryNext] = pendingSample;
+    telemetryNext = (telemetryNext + 1) % SIM7000_TELEMETRY_SAMPLES;
+    if (telemetryCount < SIM7000_TELEMETRY_SAMPLES) {
+        telemetryCount++;
+    }
+    telemetryTotal++;
+    if (debugFlag) trace_debug_P("Signal: CSQ %d, RAT %d, registration %d", pendingSample.csq, pendingSample.rat, pendingSample.regState);
+    setIdle();
+}
+
+/*!
+
+    \brief  Return count of signal/registration samples kept
+
+    \param  none
+    \return count of samples (up to SIM7000_TELEMETRY_SAMPLES)
+
+*/
+uint8_t FF_Sim7000::getSampleCount(void) {
+    return telemetryCount;
+}
+
+/*!
+
+    \brief  Return a signal/registration sample
 
-    // Get UTF-8 message length
-    while (*text) {
-        // Cout only first byte of each UTF-8 sequence
-        utf8CharCount += (*text++ & 0xc0) != 0x80;
+    Samples are taken every telemetryInterval ms, when modem is idle.
+
+    \param[in]  age: 0 for last sample, 1 for previous one, ... up to getSampleCount() - 1
+    \return pointer to sample, NULL if age is not lower than getSampleCount()
+
+*/
+const FF_Sim7000Sample* FF_Sim7000::getSample(uint8_t age) {
+    if (age >= telemetryCount) {
+        return NULL;
     }
-    // UCS-2 if 2 chars for each UTF-8 character
-    return utf8CharCount * 2;
+    return &telemetrySample[(telemetryNext + SIM7000_TELEMETRY_SAMPLES - 1 - age) % SIM7000_TELEMETRY_SAMPLES];
+}
+
+/*!
+
+    \brief  Return recent SMS chunk send time
+
+    Value is smoothed over last chunks, and may be used to choose the fastest of multiple modems.
+
+    \param  none
+    \return recent chunk send time (ms, 0 if no chunk sent yet)
+
+*/
+uint32_t FF_Sim7000::getRecentLatency(void) {
+    return recentLatency;
+}
+
+/*!
+
+    \brief  Return count of SMS waiting in outbound queue
+
+    \param  none
+    \return count of SMS in queue (including the one being sent)
+
+*/
+uint16_t FF_Sim7000::getQueueDepth(void) {
+    return smsQueue.getDepth();
+}
+
+/*!
+
+    \brief  Return max count of SMS seen in outbound queue
+
+    \param  none
+    \return outbound queue high water mark
+
+*/
+uint16_t FF_Sim7000::getQueueHighWater(void) {
+    return smsQueue.getHighWater();
+}
+
+/*!
+
+    \brief  Return count of SMS dropped because outbound queue was full
+
+    \param  none
+    \return count of dropped SMS
+
+*/
+unsigned int FF_Sim7000::getQueueDropCount(void) {
+    return smsQueue.getDropCount();
 }
\ No newline at end of file
@@ -12,19 +12,132 @@
 #define FF_Sim7000_h
 
 #include <Arduino.h>
+#include <FF_Sim7000Queue.h>
+#include <pdulib.h>                                                 // https://github.com/mgaman/PDUlib
+
+#ifdef FF_SIM7000_USE_SOFTSERIAL                                    // Define FF_SIM7000_USE_SOFTSERIAL to use SofwareSerial instead of Serial
+    #include <SoftwareSerial.h>
+    #define SIM7000_SERIAL_CLASS SoftwareSerial                     //!< Class of serial used to talk to modem
+#else
+    #define SIM7000_SERIAL_CLASS HardwareSerial                     //!< Class of serial used to talk to modem
+#endif
 
 // Constants
 #define SIM7000_CMD_TIMEOUT 4000                                    //!< Standard AT command timeout (ms)
 #define MAX_SMS_NUMBER_LEN 20                                       //!< SMS number max length
-#define MAX_ANSWER 250                                              //!< AT command answer max length
+#ifndef MAX_ANSWER
+    #define MAX_ANSWER 400                                          //!< AT command answer max length (default storage, 0 to only use setAnswerBuffer() one)
+#endif
+#ifndef SIM7000_PDU_BUFFER_LENGTH
+    #define SIM7000_PDU_BUFFER_LENGTH 1024                          //!< PDU encoder/decoder workspace length
+#endif
 #define DEFAULT_ANSWER "OK"                                         //!< AT command default answer
 #define CREG_MSG "+CREG: "                                          //!< CREG unsolicited message
 #define CREG_QUERY "+CREG?"                                         //!< CREG request
 #define SMS_INDICATOR "+CMT: "                                      //!< SMS received indicator
+#define SMS_STORED_INDICATOR "+CMTI: "                              //!< SMS stored indicator (store and drain mode)
+#define SMS_LIST_INDICATOR "+CMGL: "                                //!< SMS list header (store and drain mode)
+#define CMS_ERROR "+CMS ERROR"                                      //!< SMS error answer
+#define CME_ERROR "+CME ERROR"                                      //!< Equipment error answer
+#define ERROR_ANSWER "ERROR"                                        //!< Error final result (without error code)
 #define CSCA_INDICATOR "+CSCA:"                                     //!< SCA value indicator
 #define GSM_TIME "*PSUTTZ: "                                        //!< GSM network time
+#define CCLK_INDICATOR "+CCLK: "                                    //!< Modem clock answer
+#define CSQ_INDICATOR "+CSQ: "                                      //!< Signal quality answer
+#define CPSI_INDICATOR "+CPSI: "                                    //!< System information answer
+#ifndef SIM7000_SMS_QUEUE_SIZE
+    #define SIM7000_SMS_QUEUE_SIZE 2048                             //!< Outbound SMS queue size (bytes, each SMS uses number and text length + 4)
+#endif
+#ifndef SIM7000_MAX_SMS_CHUNKS
+    #define SIM7000_MAX_SMS_CHUNKS 10                               //!< Max chunks of one SMS (longer messages are truncated)
+#endif
+#define SIM7000_GSM7_SINGLE 160                                     //!< Max length of single GSM7 SMS (septets)
+#define SIM7000_GSM7_CHUNK 152                                      //!< Max length of GSM7 SMS chunk (septets)
+#define SIM7000_UCS2_SINGLE 70                                      //!< Max length of single UCS-2 SMS (characters)
+#define SIM7000_UCS2_CHUNK 67                                       //!< Max length of UCS-2 SMS chunk (characters)
+#ifndef SIM7000_EVENT_QUEUE_SIZE
+    #define SIM7000_EVENT_QUEUE_SIZE 1024                           //!< Deferred events queue size (bytes, each received SMS uses PDU length + 3, 0 if deferCallbacks is not used)
+#endif
+#ifndef SIM7000_REASSEMBLY_SLOTS
+    #define SIM7000_REASSEMBLY_SLOTS 2                              //!< Count of multi-part received SMS reassembled at the same time (0 to disable reassembly)
+#endif
+#ifndef SIM7000_REASSEMBLY_SIZE
+    #define SIM7000_REASSEMBLY_SIZE 1024                            //!< Max size of a reassembled multi-part received SMS (bytes)
+#endif
+#ifndef SIM7000_REASSEMBLY_PARTS
+    #define SIM7000_REASSEMBLY_PARTS 8                              //!< Max parts of a reassembled multi-part received SMS
+#endif
+#ifndef SIM7000_REASSEMBLY_TIMEOUT
+    #define SIM7000_REASSEMBLY_TIMEOUT 120000                       //!< Max time to wait for all parts of a multi-part received SMS (ms)
+#endif
+#ifndef SIM7000_TASK_STACK_SIZE
+    #define SIM7000_TASK_STACK_SIZE 8192                            //!< Stack size of modem task (ESP32 task mode, bytes)
+#endif
+#ifndef SIM7000_TASK_PRIORITY
+    #define SIM7000_TASK_PRIORITY 2                                 //!< Priority of modem task (ESP32 task mode)
+#endif
+#ifndef SIM7000_TASK_TICK
+    #define SIM7000_TASK_TICK 1000                                  //!< Max sleep time of modem task without modem data (ESP32 task mode, ms)
+#endif
+#ifndef SIM7000_RX_CHUNK_SIZE
+    #define SIM7000_RX_CHUNK_SIZE 64                                //!< Size of chunks read at once from modem
+#endif
+#ifndef SIM7000_MAX_BYTES_PER_LOOP
+    #define SIM7000_MAX_BYTES_PER_LOOP 512                          //!< Max bytes read from modem in one doLoop() call (0 for no limit)
+#endif
+//#define FF_SIM7000_USE_FIXED_BUFFERS                              //!< Store last received/sent SMS in fixed size char arrays instead of String
+#ifndef SIM7000_MAX_DATE_LEN
+    #define SIM7000_MAX_DATE_LEN 25                                 //!< Max length of last received/sent SMS date (with fixed buffers)
+#endif
+#ifndef SIM7000_MAX_MESSAGE_LEN
+    #define SIM7000_MAX_MESSAGE_LEN 481                             //!< Max length of last received/sent SMS message (with fixed buffers, longer messages are truncated)
+#endif
+//#define FF_SIM7000_STORE_AND_DRAIN                                //!< Store received SMS in modem and read them by batches (AT+CMGL) instead of direct routing (+CMT)
+#ifndef SIM7000_DRAIN_INTERVAL
+    #define SIM7000_DRAIN_INTERVAL 60000                            //!< Interval between two checks of modem SMS storage (store and drain mode, ms)
+#endif
+#ifndef SIM7000_CLEANUP_DELAY
+    #define SIM7000_CLEANUP_DELAY 30000                             //!< Time without received SMS before deferred cleanup (ms)
+#endif
+#ifndef SIM7000_TELEMETRY_SAMPLES
+    #define SIM7000_TELEMETRY_SAMPLES 8                             //!< Count of signal/registration samples kept (see getSample())
+#endif
+#ifndef SIM7000_HOLD_POLL_INTERVAL
+    #define SIM7000_HOLD_POLL_INTERVAL 10000                        //!< Signal poll interval while a multi-part SMS is held (ms)
+#endif
+#ifndef SIM7000_MAX_HOLD_TIME
+    #define SIM7000_MAX_HOLD_TIME 300000                            //!< Max time a multi-part SMS is held because of poor signal (ms)
+#endif
+#ifndef SIM7000_SMS_RETRIES
+    #define SIM7000_SMS_RETRIES 3                                   //!< Max times an SMS chunk is sent again after transient errors (per message)
+#endif
+#ifndef SIM7000_RETRY_DELAY
+    #define SIM7000_RETRY_DELAY 2000                                //!< Delay before first SMS chunk retry, doubled at each retry (ms)
+#endif
+//#define FF_SIM7000_CAPTURE                                        //!< Keep last modem TX/RX data, with time stamps, in a RAM ring (see dumpCapture())
+#ifndef SIM7000_CAPTURE_SIZE
+    #define SIM7000_CAPTURE_SIZE 4096                               //!< Capture ring size (bytes, each record uses its data length + 6)
+#endif
+#define SIM7000_CAPTURE_HEADER 6                                    //!< Size of capture record header (time, direction, length)
+#define SIM7000_CAPTURE_MAX_RECORD 255                              //!< Max data length of one capture record (longer data is split)
 //#define SIM7000_KEEP_CR_LF                                        //!< Keep CR & LF in displayed messages (by default, they're replaced by ".")
 
+// Log levels: traces above FF_SIM7000_LOG_LEVEL are removed at compile time (see FF_Sim7000Trace.h)
+#define SIM7000_LOG_NONE 0                                          //!< No trace
+#define SIM7000_LOG_ERROR 1                                         //!< Error traces only
+#define SIM7000_LOG_WARN 2                                          //!< Error and warning traces
+#define SIM7000_LOG_INFO 3                                          //!< Error, warning and information traces
+#define SIM7000_LOG_DEBUG 4                                         //!< All traces except entered routines ones
+#define SIM7000_LOG_TRACE 5                                         //!< All traces, including entered routines ones (traceFlag)
+#ifndef FF_SIM7000_LOG_LEVEL
+    #define FF_SIM7000_LOG_LEVEL SIM7000_LOG_TRACE                  //!< Highest trace level compiled in
+#endif
+#if FF_SIM7000_LOG_LEVEL >= SIM7000_LOG_TRACE
+    #define SIM7000_ENTER_ROUTINE() do { if (traceFlag) enterRoutine(__func__); } while (0)    //!< Trace entered routine (if traceFlag is set)
+#else
+    #define SIM7000_ENTER_ROUTINE() do {} while (0)                 //!< Trace entered routine (removed)
+#endif
+
 // Enums
 #define SIM7000_OK 0
 #define SIM7000_RUNNING 1
@@ -40,12 +153,167 @@
 #define SIM7000_STARTING 3
 #define SIM7000_NOT_CONNECTED 4
 
+// Command states
+#define SIM7000_CMD_NONE 0                                          //!< No command running
+#define SIM7000_CMD_ANSWER 1                                        //!< Waiting for command answer
+#define SIM7000_CMD_DELAY 2                                         //!< Waiting for some time
+#define SIM7000_CMD_SMS_READY 3                                     //!< Waiting for SMS Ready (or some time)
+#define SIM7000_CMD_DONE 4                                          //!< Command ended, completion handler will be called by dispatcher
+
+#define SIM7000_NO_DEADLINE 0xFFFFFFFFUL                            //!< getNextDeadline() value when only modem data can wake state machine up
+
+// Cleanup policies (what to do after a SMS has been received)
+#define SIM7000_CLEANUP_NONE 0                                      //!< Don't delete anything (messages are not stored with AT+CNMI=2,2)
+#define SIM7000_CLEANUP_DEFERRED 1                                  //!< Delete read messages once, when modem is idle and no SMS received for SIM7000_CLEANUP_DELAY
+#define SIM7000_CLEANUP_IMMEDIATE 2                                 //!< Delete read messages after each received SMS
+
+// Command classes (used by metrics)
+#define SIM7000_CLASS_INIT 0                                        //!< Modem initialization commands
+#define SIM7000_CLASS_CMGS_PROMPT 1                                 //!< AT+CMGS up to '>' prompt
+#define SIM7000_CLASS_CMGS_CONFIRM 2                                //!< SMS PDU up to +CMGS: confirmation
+#define SIM7000_CLASS_CMGD 3                                        //!< AT+CMGD
+#define SIM7000_CLASS_OTHER 4                                       //!< All other commands
+#define SIM7000_CLASS_COUNT 5                                       //!< Count of command classes
+
+// SMS send error classes (see classifySmsError())
+#define SIM7000_SMS_ERROR_RETRY 0                                   //!< Transient (network) error, chunk is sent again after a delay
+#define SIM7000_SMS_ERROR_FAIL 1                                    //!< Error on this message (bad number, bad PDU...), message is dropped
+#define SIM7000_SMS_ERROR_RESTART 2                                 //!< Modem or SIM error, modem should be restarted
+
+// Modem status changes given to status callback (see registerStatusCb())
+#define SIM7000_STATUS_READY 0                                      //!< Init done, modem is ready (reason is restart count)
+#define SIM7000_STATUS_INIT_FAILED 1                                //!< Init failed, modem should be restarted (reason is restart reason)
+#define SIM7000_STATUS_RESTART 2                                    //!< Modem should be restarted after init (reason is restart reason)
+
+#define SIM7000_HISTOGRAM_BUCKETS 10                                //!< Latency buckets: <50, <100, <250, <500, <1000, <2500, <5000, <10000, <30000, >=30000 ms
+
+//! Latency histogram
+struct FF_Sim7000Histogram {
+    uint32_t bucket[SIM7000_HISTOGRAM_BUCKETS];                     //!< Count of measures per bucket
+    uint32_t count;                                                 //!< Count of measures
+    uint32_t totalMs;                                               //!< Sum of measures (ms)
+    uint32_t maxMs;                                                 //!< Max measure (ms)
+};
+
+//! Metrics of one command class
+struct FF_Sim7000CommandMetrics {
+    FF_Sim7000Histogram latency;                                    //!< Latency of successful commands
+    uint32_t timeoutCount;                                          //!< Count of time-outs
+    uint32_t errorCount;                                            //!< Count of CMS/CME errors
+};
+
+//! Modem metrics (see FF_Sim7000::getMetrics())
+struct FF_Sim7000Metrics {
+    FF_Sim7000CommandMetrics command[SIM7000_CLASS_COUNT];          //!< Metrics per command class
+    FF_Sim7000Histogram chunkSend;                                  //!< Time to send one SMS chunk outside of a batch (AT+CMGS to +CMGS:)
+    FF_Sim7000Histogram messageSend;                                //!< Time to send a full SMS outside of a batch (first AT+CMGS to last +CMGS:)
+    FF_Sim7000Histogram batchChunkSend;                             //!< Time to send one SMS chunk in a batch (AT+CMGS to +CMGS:)
+    FF_Sim7000Histogram batchMessageSend;                           //!< Time to send a full SMS in a batch (AT+CMMS or first AT+CMGS to last +CMGS:)
+    uint32_t loopCount;                                             //!< Count of doLoop() calls
+    uint32_t loopTotalUs;                                           //!< Time spent in doLoop() (us)
+    uint32_t loopMaxUs;                                             //!< Max time spent in one doLoop() call (us)
+    uint32_t rxBytes;                                               //!< Count of bytes received from modem (or replayed)
+    uint32_t rxLines;                                               //!< Count of lines received from modem (or replayed)
+    uint32_t reassembledCount;                                      //!< Count of multi-part received SMS reassembled
+    uint32_t reassemblyDropCount;                                   //!< Count of multi-part received SMS dropped (time-out, eviction or too long)
+    uint32_t smsRetryCount;                                         //!< Count of SMS chunks sent again after a transient error
+    uint32_t smsFailCount;                                          //!< Count of SMS dropped (permanent error, or interrupted twice by a restart)
+};
+
+#define SIM7000_WARM_MAGIC 0x53374B57UL                             //!< FF_Sim7000WarmState magic value, when valid
+
+//! Modem state saved after a successful init, allowing a fast (warm) init at next restart
+struct FF_Sim7000WarmState {
+    uint32_t magic;                                                 //!< SIM7000_WARM_MAGIC if state is valid
+    char scaNumber[MAX_SMS_NUMBER_LEN+1];                           //!< SMS service center number
+    uint32_t bootTime;                                              //!< Learned modem boot time (ms, 0 if unknown), kept even if magic is not valid
+};
+
+struct initStepsStruct;
+class FF_Sim7000;
+
+#define SIM7000_MAX_COMMAND_LEN 64                                  //!< AT command max length (including grouped init commands)
+#ifndef SIM7000_CMD_QUEUE_SIZE
+    #define SIM7000_CMD_QUEUE_SIZE 4                                //!< Count of commands waiting to be sent when modem is idle
+#endif
+
+//! Command descriptor (see FF_Sim7000::queueCommand())
+struct FF_Sim7000Command {
+    char command[SIM7000_MAX_COMMAND_LEN];                          //!< Command to send
+    const char* answer;                                             //!< Expected answer (NULL if answer should not be waited for)
+    unsigned long timeout;                                          //!< Max time to wait for answer (ms)
+    uint8_t retries;                                                //!< Count of times command is sent again after a time-out
+    void (FF_Sim7000::*onComplete)(void);                           //!< Completion handler (NULL to set modem idle)
+};
+
+// Radio access technologies (from AT+CPSI?)
+#define SIM7000_RAT_UNKNOWN 0                                       //!< Not yet known
+#define SIM7000_RAT_NONE 1                                          //!< No service
+#define SIM7000_RAT_GSM 2                                           //!< GSM
+#define SIM7000_RAT_CAT_M1 3                                        //!< LTE CAT-M1
+#define SIM7000_RAT_NB_IOT 4                                        //!< LTE NB-IOT
+#define SIM7000_CSQ_UNKNOWN 99                                      //!< Signal quality not known or not detectable
+
+//! Signal and registration sample (see FF_Sim7000::getSample())
+struct FF_Sim7000Sample {
+    uint32_t time;                                                  //!< millis() when sample has been taken
+    uint8_t csq;                                                    //!< Signal quality (0-31, RSSI is -113 + 2 * csq dBm, SIM7000_CSQ_UNKNOWN if not known)
+    uint8_t ber;                                                    //!< Bit error rate (0-7, SIM7000_CSQ_UNKNOWN if not known)
+    uint8_t rat;                                                    //!< Radio access technology (SIM7000_RAT_xxx)
+    uint8_t regState;                                               //!< Network registration state (+CREG, 1 = home, 5 = roaming)
+};
+
+//! Message plan (see FF_Sim7000::planMessage())
+struct FF_Sim7000MessagePlan {
+    bool isGsm7;                                                    //!< True if message is GSM7, false if UCS-2
+    bool isTruncated;                                               //!< True if message needs more than SIM7000_MAX_SMS_CHUNKS chunks
+    uint16_t length;                                                //!< Message length (GSM7 septets or UCS-2 characters)
+    uint8_t chunkCount;                                             //!< Count of chunks (0 if message fits in one SMS)
+    uint16_t chunkOffset[SIM7000_MAX_SMS_CHUNKS+1];                 //!< UTF-8 offset of each chunk (last one is end of message)
+};
+
+#if SIM7000_REASSEMBLY_SLOTS > 0
+//! Multi-part received SMS being reassembled
+struct FF_Sim7000ReassemblySlot {
+    bool inUse;                                                     //!< Slot is used
+    char sender[MAX_SMS_NUMBER_LEN+1];                              //!< Sender phone number
+    char date[SIM7000_MAX_DATE_LEN];                                //!< Date of first received part
+    uint16_t reference;                                             //!< Concatenated SMS reference
+    uint8_t total;                                                  //!< Total count of parts
+    uint8_t receivedCount;                                          //!< Count of parts received
+    uint32_t receivedMask;                                          //!< Bit mask of parts received (bit 0 for part 1)
+    unsigned long startTime;                                        //!< Time of first part reception
+    uint16_t partOffset[SIM7000_REASSEMBLY_PARTS];                  //!< Offset of each part in text
+    uint16_t partLength[SIM7000_REASSEMBLY_PARTS];                  //!< Length of each part in text
+    uint16_t textLength;                                            //!< Length of data in text
+    char text[SIM7000_REASSEMBLY_SIZE];                             //!< Parts text, in reception order
+};
+#endif
+
 #ifndef SIM7000_PIN_ACTIVE
     #define SIM7000_PIN_ACTIVE HIGH
 #endif
 #ifndef SIM7000_PIN_INACTIVE
     #define SIM7000_PIN_INACTIVE LOW
 #endif
+#ifndef SIM7000_STATUS_ACTIVE
+    #define SIM7000_STATUS_ACTIVE HIGH                              //!< Level of modem STATUS pin when modem is on
+#endif
+#ifndef SIM7000_BOOT_PROBE_INTERVAL
+    #define SIM7000_BOOT_PROBE_INTERVAL 500                         //!< Interval between two AT sent while waiting for modem to boot (adaptive power on, ms)
+#endif
+#ifndef SIM7000_HIGH_SPEED
+    #if defined(FF_SIM7000_USE_SOFTSERIAL)
+        #define SIM7000_HIGH_SPEED 57600                            //!< Modem speed negotiated when highSpeed is set (bds)
+    #elif defined(ESP32)
+        #define SIM7000_HIGH_SPEED 921600                           //!< Modem speed negotiated when highSpeed is set (bds)
+    #else
+        #define SIM7000_HIGH_SPEED 460800                           //!< Modem speed negotiated when highSpeed is set (bds)
+    #endif
+#endif
+#define SIM7000_BAUD_PROBE_TIMEOUT 300                              //!< Time to wait for AT answer at each probed speed (ms)
+#define SIM7000_BAUD_PROBE_COUNT 32                                 //!< Max count of AT sent while looking for modem speed
+#define SIM7000_SPEED_TEST_COUNT 3                                  //!< Count of test transfers needed to keep negotiated speed
 
 // Class definition
 class FF_Sim7000 {
@@ -59,13 +327,36 @@ public:
         Messages are in UTF-8 format and automatically converted into GSM7 (160 characters) or UCS-2 (70 characters).
 
         A callback routine in your program will be called each time a SMS is received.
+            Multi-part SMS are reassembled before calling it once with full message.
+            If deferCallbacks is set, it'll be called by dispatchEvents() instead of doLoop(), as sent SMS, line and status callbacks.
+            If FF_SIM7000_STORE_AND_DRAIN is defined, SMS are stored by modem, then read by batches and deleted at once.
 
-        You also may send SMS directly.
+        You also may send SMS directly. They're queued and sent one after the other as soon as modem is idle.
+            Once fully sent, send callback is called.
+            If batchSend is set, multi-part messages and queued bursts are sent with AT+CMMS=2, keeping radio link open between them.
 
         By default, logging/debugging is done through FF_TRACE macros, allowing to easily change code.
 
+        If FF_SIM7000_CAPTURE is defined, last modem TX/RX data is kept in a RAM ring, given back by dumpCapture()
+            (also called when a restart is needed) in a form replay() can use.
+
         It may also be used with FF_WebServer class, as containing routines to map with it.
 
+        Instead of calling doLoop() continuously, application may sleep as long as getNextDeadline() says,
+            or until modem data is signaled (notifyRxData() may be called from UART interrupt or event).
+
+        On ESP32, startTask() runs modem in its own task, woken by modem data. Application then only calls sendSMS()
+            and dispatchEvents(), which exchange data with modem task through lock-free queues.
+
+        If adaptivePowerOn is set, modem is probed (AT, RDY or STATUS pin) during last power step, init starting as soon as it answers.
+            Boot time is learned, to avoid probing too early.
+
+        Once modem has been fully initialized, next restarts check modem config with one combined query,
+            and run full init only if it changed (see warmStart and getWarmState()).
+
+        Several instances may be used at the same time, each one with its own serial given to begin().
+            FF_Sim7000Pool may then spread outbound SMS over them.
+
         You may have a look at https:                               //github.com/FlyingDomotic/FF_SmsServer which shows how to use it
 
         By default, FF_Sim7000 uses Sim7000 modem connected on D8(TX) and D7(RX) on ESP8266.
@@ -80,45 +371,115 @@ public:
 
     // Public routines (documented in FF_Sim7000.cpp)
     void begin(long baudRate, int8_t rxPin, int8_t txPin, int8_t powerPin=-1);
+    void begin(SIM7000_SERIAL_CLASS& serial, long baudRate, int8_t rxPin, int8_t txPin, int8_t powerPin=-1);
+    void setAnswerBuffer(char* buffer, size_t size);
+    const FF_Sim7000WarmState& getWarmState(void);
+    void setWarmState(const FF_Sim7000WarmState& state);
+    #if defined(ESP32) && !defined(FF_SIM7000_USE_SOFTSERIAL)
+        bool startTask(BaseType_t core = 1, uint32_t stackSize = SIM7000_TASK_STACK_SIZE, UBaseType_t priority = SIM7000_TASK_PRIORITY);
+    #endif
     void doLoop(void);
+    unsigned long getNextDeadline(void);
+    void notifyRxData(void);
+    uint16_t dispatchEvents(void);
+    void replay(const char* data, size_t length);
     void debugState(void);
-    void sendSMS(const char* number, const char* text);
-    void sendOneSmsChunk(const char* number, const char* text, const unsigned short msgId = 0, const unsigned char msgCount = 0, const unsigned char msgIndex = 0);
+    bool sendSMS(const char* number, const char* text);
     void registerSmsCb(void (*readSmsCallback)(const char* __number, const char* __date, const char* __message));
     void registerSendCb(void (*sendSmsCallback)(const char* __number, const char* __date, const char* __message));
     void registerLineCb(void (*recvLineCallback)(const char* __answer));
+    void registerStatusCb(void (*statusCallback)(int __status, int __reason));
+    #ifdef FF_SIM7000_CAPTURE
+        void registerCaptureCb(void (*captureCallback)(unsigned long __time, bool __sent, const char* __data, size_t __length));
+        void dumpCapture(void);
+        void clearCapture(void);
+    #endif
     void deleteSMS(int index, int flag);
     void sendAT(const char* command);
     void sendEOF(void);
     void setPowerPin(void);
+    void setStatusPin(int8_t statusPin);
     bool needRestart(void);
     int getRestartReason(void);
     void setRestart(bool restartFlag);
     void waitUntilSmsReady(void);
     void gotSca(void);
     void initComplete(void);
+    void gotWarmState(void);
+    void sendNextGroupPart(void);
+    void warmComplete(void);
+    void probeModemSpeed(void);
+    void gotProbeAnswer(void);
+    void setModemSpeed(void);
+    void testModemSpeed(void);
+    void gotSpeedTest(void);
+    bool gotCreg(void);
+    bool gotNetworkTime(void);
+    bool gotClock(void);
+    bool gotCsq(void);
+    bool gotCpsi(void);
+    void telemetryComplete(void);
+    bool gotSmsIndicator(void);
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+        bool gotSmsStored(void);
+        bool gotSmsListHeader(void);
+        void drainComplete(void);
+    #endif
+    bool gotCmError(void);
     bool isIdle(void);
     bool isSending(void);
     bool isReceiving(void);
     uint8_t getGsm7EquivalentLen(const uint8_t c1, const uint8_t c2, const uint8_t c3);
     uint16_t ucs2MessageLength(const char* text);
+    void planMessage(const char* text, FF_Sim7000MessagePlan* plan);
+    uint32_t getRecentLatency(void);
+    uint32_t getTime(void);
+    const char* getLastSentDate(void);
+    uint16_t getQueueDepth(void);
+    uint16_t getQueueHighWater(void);
+    unsigned int getQueueDropCount(void);
+    const FF_Sim7000Metrics& getMetrics(void);
+    uint8_t getSampleCount(void);
+    const FF_Sim7000Sample* getSample(uint8_t age);
+    void resetMetrics(void);
 
     // Public variables
     bool debugFlag;                                                 //!< Show debug messages flag
     bool traceFlag;                                                 //!< Show trace messages flag
     bool traceEnterFlag;                                            //!< Show each routine entering flag
     bool ignoreErrors;                                              //!< Ignore errors flag
+    bool deferCallbacks;                                            //!< Call callbacks from dispatchEvents() instead of doLoop()
+    unsigned long loopBudget;                                       //!< Max time spent in doLoop() (us, 0 to handle one line per call)
+    uint8_t cleanupPolicy;                                          //!< What to do after a SMS has been received (SIM7000_CLEANUP_xxx)
+    bool ackSms;                                                    //!< Acknowledge received SMS with AT+CNMA instead of cleanup (when AT+CSMS=1 is used)
+    bool autoBaud;                                                  //!< Look for modem speed (trying common speeds) if it doesn't answer at begin() speed (default false)
+    bool highSpeed;                                                 //!< Switch modem to SIM7000_HIGH_SPEED (checked with a test transfer) instead of begin() speed
+    bool adaptivePowerOn;                                           //!< Probe modem while it boots instead of waiting for full last power step
+    bool warmStart;                                                 //!< Check modem config with one query at restart, running full init only if it changed
+    bool batchSend;                                                 //!< Keep radio link open (AT+CMMS=2) while sending multi-part messages or queued bursts
+    unsigned long telemetryInterval;                                //!< Interval between signal/registration polls (AT+CSQ, AT+CPSI?, AT+CREG?) when idle (ms, 0 to disable)
+    uint8_t minMultipartCsq;                                        //!< Hold multi-part SMS while signal quality is below this value (0 to never hold)
     bool smsReady;                                                  //!< True if "SMS ready" seen
-    String lastReceivedNumber;                                      //!< Phone number of last received SMS
-    String lastReceivedDate;                                        //!< Date of last received SMS
-    String lastReceivedMessage;                                     //!< Message of last received SMS
-    String lastSentNumber;                                          //!< Phone number of last SMS sent
-    String lastSentDate;                                            //!< Date of last SMS sent
-    String lastSentMessage;                                         //!< Message of last SMS sent
+    #ifdef FF_SIM7000_USE_FIXED_BUFFERS
+        char lastReceivedNumber[MAX_SMS_NUMBER_LEN+1];              //!< Phone number of last received SMS
+        char lastReceivedDate[SIM7000_MAX_DATE_LEN];                //!< Date of last received SMS
+        char lastReceivedMessage[SIM7000_MAX_MESSAGE_LEN];          //!< Message of last received SMS
+        char lastSentNumber[MAX_SMS_NUMBER_LEN+1];                  //!< Phone number of last SMS sent
+        char lastSentDate[SIM7000_MAX_DATE_LEN];                    //!< Date of last SMS sent (formatted by getLastSentDate())
+        char lastSentMessage[SIM7000_MAX_MESSAGE_LEN];              //!< Message of last SMS sent
+    #else
+        String lastReceivedNumber;                                  //!< Phone number of last received SMS
+        String lastReceivedDate;                                    //!< Date of last received SMS
+        String lastReceivedMessage;                                 //!< Message of last received SMS
+        String lastSentNumber;                                      //!< Phone number of last SMS sent
+        String lastSentDate;                                        //!< Date of last SMS sent (formatted by getLastSentDate())
+        String lastSentMessage;                                     //!< Message of last SMS sent
+    #endif
 
 private:
     // Private routines (documented in FF_Sim7000.cpp)
     void open(void);
+    void runLoop(void);
     void sendCommand(const char *command, void (FF_Sim7000::*nextStep)(void)=NULL, const char *resp=DEFAULT_ANSWER, unsigned long cdeTimeout=SIM7000_CMD_TIMEOUT, uint8_t repeat=0);
     void sendCommand(const uint8_t command, void (FF_Sim7000::*nextStep)(void)=NULL, const char *resp=DEFAULT_ANSWER, unsigned long cdeTimeout=SIM7000_CMD_TIMEOUT);
     void waitSmsReady(unsigned long waitMs, void (FF_Sim7000::*nextStep)(void)=NULL);
@@ -126,10 +487,64 @@ private:
     void openModem(long baudRate);
     void sendSMStext(void);
     void setIdle(void);
-    void enterRoutine(const char* routineName);
-    void readSmsHeader(const char* msg);
+    #if FF_SIM7000_LOG_LEVEL >= SIM7000_LOG_TRACE
+        void enterRoutine(const char* routineName);
+    #endif
+    void readSmsHeader(void);
     void readSmsMessage(const char* msg);
+    void decodeSmsMessage(const char* msg);
+    void deliverSms(const char* number, const char* date, const char* message);
+    void reassembleSms(const char* number, const char* date, const char* message, uint16_t reference, uint8_t part, uint8_t total);
+    void checkReassemblyTimeout(void);
     void resetLastAnswer(void);
+    int readModem(void);
+    void processLine(void);
+    void matchUrc(size_t position, char c);
+    void checkSmsQueue(void);
+    void releaseQueuedSms(bool restarting);
+    void cleanupReceivedSms(void);
+    bool checkWarmLine(void);
+    bool checkModemBoot(void);
+    bool inGroupedInitStep(void);
+    void endPowerSteps(void);
+    void notifySmsSent(void);
+    void setNetworkTime(uint32_t utcTime);
+    bool holdMultipartSms(char* text);
+    void pollTelemetry(void);
+    long getProbeSpeed(uint8_t index);
+    void sendSpeedTest(void);
+    #if defined(ESP32) && !defined(FF_SIM7000_USE_SOFTSERIAL)
+        static void taskEntry(void* parameter);
+        void taskLoop(void);
+    #endif
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+        void drainStoredSms(void);
+    #endif
+    void recordCommand(int status);
+    void completeCommand(int status);
+    void dispatchCommand(void);
+    bool queueCommand(const char* command, void (FF_Sim7000::*onComplete)(void)=NULL, const char* answer=DEFAULT_ANSWER, unsigned long timeout=SIM7000_CMD_TIMEOUT, uint8_t retries=0);
+    void sendQueuedSms(const char* number, char* text);
+    void sendSmsChunk(uint8_t chunk);
+    void sendOneSmsChunk(const char* number, const char* text, const unsigned short msgId = 0, const unsigned char msgCount = 0, const unsigned char msgIndex = 0);
+    int encodeSmsChunk(uint8_t chunk, uint8_t workspace);
+    void prepareNextSmsChunk(void);
+    void sendChunkCommand(int length);
+    void sendFirstSmsChunk(void);
+    void endSmsBatch(void);
+    void notifyStatus(int status, int reason);
+    void writeModem(const char* data, size_t length);
+    void writeModem(const char* data);
+    #ifdef FF_SIM7000_CAPTURE
+        void captureData(bool sent, const char* data, size_t length);
+        void captureCopy(uint16_t position, const void* data, uint16_t length);
+        void captureRead(uint16_t position, void* data, uint16_t length);
+    #endif
+    void waitDelay(unsigned long waitMs, void (FF_Sim7000::*nextStep)(void));
+    void smsSendError(void);
+    void smsSendFailed(void);
+    void waitSmsRetry(void);
+    void resendSmsChunk(void);
 
     // Private variables
     unsigned long startTime;                                        //!< Last command start time
@@ -142,14 +557,68 @@ private:
     int8_t modemRxPin;                                              //!< Modem RX pin
     int8_t modemTxPin;                                              //!< Modem TX pin
     int8_t modemPowerPin;                                           //!< Modem power pin
+    int8_t modemStatusPin;                                          //!< Modem status pin (-1 if not connected)
+    unsigned long lastBootProbe;                                    //!< Last time AT was sent while waiting for modem to boot
+    bool bootProbing;                                               //!< True if serial has been opened to probe modem while it boots
     long modemSpeed;                                                //!< Modem speed
+    long currentSpeed;                                              //!< Speed serial is currently opened at (0 if not yet known)
+    long targetSpeed;                                               //!< Speed modem is being switched to
+    uint8_t probeIndex;                                             //!< Index of speed being probed
+    uint8_t probeCount;                                             //!< Count of AT sent while looking for modem speed
+    uint8_t speedTestCount;                                         //!< Count of test transfers still to do at negotiated speed
+    uint32_t speedTestHash;                                         //!< Hash of current test transfer answer lines
+    uint32_t speedTestReference;                                    //!< Hash of first test transfer answer lines
+    bool probingSpeed;                                              //!< True if looking for modem speed or testing it (answer timeout is not an error)
+    bool inTelemetry;                                               //!< True if polling signal/registration (errors are not fatal)
+    uint8_t regState;                                               //!< Last network registration state (+CREG)
+    FF_Sim7000Sample telemetrySample[SIM7000_TELEMETRY_SAMPLES];   //!< Signal/registration samples ring
+    FF_Sim7000Sample pendingSample;                                 //!< Sample being filled by current poll
+    uint8_t telemetryNext;                                          //!< Index of next sample to write
+    uint8_t telemetryCount;                                         //!< Count of valid samples
+    uint16_t telemetryTotal;                                        //!< Count of samples taken (wraps)
+    uint16_t holdSampleCount;                                       //!< telemetryTotal value when held SMS has been checked
+    unsigned long lastTelemetryTime;                                //!< Last signal/registration poll time
+    unsigned long holdStartTime;                                    //!< Time queued multi-part SMS began to be held (0 if not held)
+    bool highSpeedFailed;                                           //!< True if test transfer failed at SIM7000_HIGH_SPEED (begin() speed is used)
     int8_t powerStep;                                               //!< Modem power step index
     bool modemConnected;                                            //!< Modem connected to GSM network flag
     void (FF_Sim7000::*nextStepCb)(void);                           //!< Callback for next step in command execution
     void (*readSmsCb)(const char* __number, const char* __date, const char* __message); //!< Callback for readSMS
     void (*sendSmsCb)(const char* __number, const char* __date, const char* __message); //!< Callback for sendSMS
     void (*recvLineCb)(const char* __answer);                       //!< Callback for received line
+    void (*statusCb)(int __status, int __reason);                   //!< Callback for modem status changes
+    bool restartNotified;                                           //!< True if status callback has been given restart since it has been requested
+    bool modemReady;                                                //!< True if init completed since last begin()
+    #ifdef FF_SIM7000_CAPTURE
+        void (*captureCb)(unsigned long __time, bool __sent, const char* __data, size_t __length); //!< Callback for dumped capture records
+        uint8_t captureBuffer[SIM7000_CAPTURE_SIZE];                //!< Capture ring storage
+        uint16_t captureStart;                                      //!< Offset of oldest capture record
+        uint16_t captureEnd;                                        //!< Offset of next capture record
+        uint16_t captureUsed;                                       //!< Bytes used in capture ring
+        uint16_t captureLast;                                       //!< Offset of newest capture record (extended by data sent/received in same ms)
+        unsigned long captureLastTime;                              //!< Time of newest capture record
+        bool captureLastSent;                                       //!< Direction of newest capture record
+        bool captureDumped;                                         //!< True if capture has been dumped since restart has been requested
+    #endif
     void sendNextInitStep(void);                                    //!< Send next init step command
+    const struct initStepsStruct* stepTable;                        //!< Init steps table in use (initSteps or warmSteps)
+    uint8_t stepCount;                                              //!< Count of steps in stepTable
+    uint8_t stepPtr;                                                //!< Pointer into stepTable
+    bool groupSplit;                                                //!< True if commands of current grouped step are sent one by one (after an error)
+    uint8_t groupPart;                                              //!< Index of command sent in current grouped step
+    SIM7000_SERIAL_CLASS* modemSerial;                              //!< Serial used to talk to modem
+    #ifdef FF_SIM7000_USE_SOFTSERIAL
+        SoftwareSerial softSerial;                                  //!< Default software serial, used if begin() didn't give one
+    #endif
+    PDU smsPdu;                                                     //!< PDU used to decode received SMS (only by dispatchEvents() when deferCallbacks is set)
+    PDU smsTxPdu[2];                                                //!< PDU used to encode sent SMS (one sent, one prepared)
+    uint32_t recentLatency;                                         //!< Smoothed recent SMS chunk send time (ms)
+    FF_Sim7000WarmState warmState;                                  //!< State saved by last successful init
+    bool inWarmQuery;                                               //!< True while waiting for answers of warm start query
+    uint8_t warmMatchMask;                                          //!< Bit mask of warm start query answers matching expected ones
+    #if defined(ESP32) && !defined(FF_SIM7000_USE_SOFTSERIAL)
+        TaskHandle_t taskHandle;                                    //!< Modem task (NULL if not in task mode)
+    #endif
     void sendCurrentInitStep(void);                                 //!< Send current init step command
     int index;                                                      //!< Index of last read SMS
     int restartReason;                                              //!< Last restart reason
@@ -158,20 +627,74 @@ private:
     unsigned long powerStepDuration[5];                             //!< Power steps duration
     int gsmStatus;                                                  //!< Last command status
     int gsmIdle;                                                    //!< GSM is idle flag
-    bool inReceive;                                                 //!< Are we receiving answer?
-    bool inWait;                                                    //!< Are we waiting for some time?
-    bool inWaitSmsReady;                                            //!< Are we waiting for SMS Ready?
+    uint8_t cmdState;                                               //!< Command state (SIM7000_CMD_xxx)
+    uint8_t cmdRetries;                                             //!< Count of times running command can still be sent again
+    FF_Sim7000Command cmdQueue[SIM7000_CMD_QUEUE_SIZE];             //!< Commands waiting to be sent by dispatcher
+    uint8_t cmdQueueRead;                                           //!< Index of oldest command in cmdQueue
+    uint8_t cmdQueueCount;                                          //!< Count of commands in cmdQueue
     bool restartNeeded;                                             //!< Restart needed flag
     bool nextLineIsSmsMessage;                                      //!< True if next line will be an SMS message (just after SMS header)
+    bool smsDuringCommand;                                          //!< True if SMS header has been received while a command was running
+    bool cleanupPending;                                            //!< True if received messages should be deleted (deferred cleanup)
+    unsigned long lastSmsTime;                                      //!< Time of last received SMS
+    #ifdef FF_SIM7000_STORE_AND_DRAIN
+        bool smsStored;                                             //!< True if modem signaled a new stored SMS
+        bool inDrain;                                               //!< True while reading stored SMS list
+        uint16_t drainReadCount;                                    //!< Count of SMS read by current drain
+        unsigned long lastDrainTime;                                //!< Last time modem SMS storage has been read
+    #endif
     bool firstInitDone;                                             //!< True if first init done
     bool modemSpeaking;                                             //!< Modem has spoke
-    char lastAnswer[MAX_ANSWER];                                    //!< Contains the last GSM command anwser
+    #if MAX_ANSWER > 0
+        char answerBuffer[MAX_ANSWER];                              //!< Default storage of lastAnswer
+    #endif
+    char* lastAnswer;                                               //!< Contains the last GSM command anwser (zero terminated only when line is complete)
+    size_t answerSize;                                              //!< Size of lastAnswer storage
+    size_t answerLen;                                               //!< Length of data in lastAnswer
+    char rxBuffer[SIM7000_RX_CHUNK_SIZE];                           //!< Last chunk read from modem
+    size_t rxPos;                                                   //!< Position of next character to analyze in rxBuffer
+    size_t rxLen;                                                   //!< Length of data in rxBuffer
+    volatile bool rxNotified;                                       //!< True if notifyRxData() has been called since last doLoop()
+    const char* replayData;                                         //!< Data to analyze instead of modem data (see replay())
+    size_t replayLength;                                            //!< Length of replayData
     char expectedAnswer[10];                                        //!< Expected answer to consider command ended
-    char lastCommand[30];                                           //!< Last command sent
-    uint16_t gsm7Length;                                            //!< Size of GSM-7 message (0 for UCS-2 messages)
+    uint8_t expectedLength;                                         //!< Length of expected answer
+    bool isDefaultAnswer;                                           //!< True if expected answer is DEFAULT_ANSWER
+    uint32_t syncTime;                                              //!< Unix time given by network (*PSUTTZ or +CCLK), 0 if not yet known
+    unsigned long syncMillis;                                       //!< millis() when syncTime has been received
+    uint32_t lastSentTime;                                          //!< Unix time of last SMS sent (lastSentDate is formatted from it when read)
+    bool lastSentDateValid;                                         //!< True if lastSentDate has been formatted from lastSentTime
+    uint16_t urcCandidates;                                         //!< Bit mask of urcTable entries still matching current line
+    uint8_t urcMatch;                                               //!< Index of urcTable entry matching current line (or table size if none)
+    char lastCommand[SIM7000_MAX_COMMAND_LEN];                      //!< Last command sent
+    FF_Sim7000MessagePlan smsPlan;                                  //!< Plan of message being sent
+    const char* smsNumber;                                          //!< Phone number of message being sent (in outbound queue)
+    char* smsText;                                                  //!< Message being sent (in outbound queue, temporary modified by encodeSmsChunk())
     unsigned short smsMsgId;                                        //!< Multi-part message ID (to be incremented for each multi-part message sent)
     uint8_t smsMsgIndex;                                            //!< Chunk index of current multi-part message
     uint8_t smsMsgCount;                                            //!< Chunk total count of current multi-part message
-    uint8_t smsChunkSize;                                           //!< Chunk size for this message
+    bool inBatch;                                                   //!< True if AT+CMMS=2 has been sent for current batch
+    uint8_t txPduIndex;                                             //!< Index of TX PDU workspace holding chunk being sent
+    int preparedLength;                                             //!< PDU length of next chunk, already encoded in other TX PDU workspace (0 if none)
+    uint8_t smsRetries;                                             //!< Count of chunk retries done for current message
+    bool smsDone;                                                   //!< True if current message has been fully sent (or dropped)
+    bool smsRestarted;                                              //!< True if first queued SMS has already been interrupted by a restart
+    uint8_t smsErrorClass;                                          //!< Class of last SMS send error (SIM7000_SMS_ERROR_xxx)
+    FF_Sim7000Queue smsQueue;                                       //!< Outbound SMS queue
+    uint8_t smsQueueBuffer[SIM7000_SMS_QUEUE_SIZE];                 //!< Outbound SMS queue storage
+    bool queueSending;                                              //!< True if first SMS of queue is being sent
+    FF_Sim7000Queue eventQueue;                                     //!< Deferred events queue
+    #if SIM7000_EVENT_QUEUE_SIZE > 0
+        uint8_t eventQueueBuffer[SIM7000_EVENT_QUEUE_SIZE];         //!< Deferred events queue storage
+    #endif
+    unsigned long loopStartTime;                                    //!< Start of current doLoop() call (us)
+    FF_Sim7000Metrics metrics;                                      //!< Modem metrics
+    #if SIM7000_REASSEMBLY_SLOTS > 0
+        FF_Sim7000ReassemblySlot reassemblySlot[SIM7000_REASSEMBLY_SLOTS]; //!< Multi-part received SMS being reassembled
+        char reassembledText[SIM7000_REASSEMBLY_SIZE+1];            //!< Reassembled multi-part message, in part order
+    #endif
+    uint8_t commandClass;                                           //!< Class of last command sent
+    unsigned long chunkStartTime;                                   //!< Start time of current SMS chunk
+    unsigned long messageStartTime;                                 //!< Start time of current SMS
 };
 #endif
\ No newline at end of file
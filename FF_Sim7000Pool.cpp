@@ -0,0 +1,132 @@
+/*!
+    \file
+    \brief  Spreads outbound SMS over multiple FF_Sim7000 modems
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Estimated wait time of each modem is (SMS in queue + 1) * recent chunk send time (one second if unknown),
+        plus one SMS if modem is busy receiving. Modems needing restart or not yet started are only used if no other one accepts SMS.
+*/
+
+#include <FF_Sim7000Pool.h>
+#include <FF_Trace.h>
+#include <FF_Sim7000Trace.h>
+
+#define POOL_DEFAULT_LATENCY 1000                                   // Chunk send time used when not yet known (ms)
+#define POOL_NOT_READY 0xFFFFFFFF                                   // Cost of a modem not ready to send
+
+// Class constructor : init some variables
+FF_Sim7000Pool::FF_Sim7000Pool() {
+    modemCount = 0;
+}
+
+/*!
+
+    \brief  Add a modem to pool
+
+    \param[in]  modem: modem to add (should remain allocated while pool is used)
+    \return true if modem has been added, false if pool is full
+
+*/
+bool FF_Sim7000Pool::add(FF_Sim7000* modem) {
+    if (modemCount >= SIM7000_POOL_SIZE) {
+        trace_error_P("Pool is full, can't add modem", NULL);
+        return false;
+    }
+    modems[modemCount++] = modem;
+    return true;
+}
+
+/*!
+
+    \brief  Pool loop (should be called in main loop instead of each modem doLoop())
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000Pool::doLoop(void) {
+    for (uint8_t i = 0; i < modemCount; i++) {
+        modems[i]->doLoop();
+    }
+}
+
+/*!
+
+    \brief  Queue an SMS on the modem with lowest estimated wait time
+
+    If this modem queue is full, next best one is tried, and so on.
+
+    \param[in]  number: phone number to send message to
+    \param[in]  text: message to send
+    \return true if SMS has been queued, false if no modem queue accepted it
+
+*/
+bool FF_Sim7000Pool::sendSMS(const char* number, const char* text) {
+    uint32_t cost[SIM7000_POOL_SIZE];
+    bool tried[SIM7000_POOL_SIZE];
+    for (uint8_t i = 0; i < modemCount; i++) {
+        cost[i] = getCost(modems[i]);
+        tried[i] = false;
+    }
+    for (uint8_t attempt = 0; attempt < modemCount; attempt++) {
+        // Find best modem not yet tried
+        int8_t best = -1;
+        for (uint8_t i = 0; i < modemCount; i++) {
+            if (!tried[i] && (best < 0 || cost[i] < cost[best])) {
+                best = i;
+            }
+        }
+        tried[best] = true;
+        if (modems[best]->sendSMS(number, text)) {
+            trace_debug_P("SMS to %s queued on modem %d", number, best);
+            return true;
+        }
+    }
+    trace_error_P("No modem accepted SMS to %s", number);
+    return false;
+}
+
+/*!
+
+    \brief  Return a modem of pool
+
+    \param[in]  index: modem index (in add() order)
+    \return modem (NULL if index is out of range)
+
+*/
+FF_Sim7000* FF_Sim7000Pool::getModem(uint8_t index) {
+    return index < modemCount ? modems[index] : NULL;
+}
+
+/*!
+
+    \brief  Return count of modems in pool
+
+    \param  none
+    \return count of modems
+
+*/
+uint8_t FF_Sim7000Pool::getCount(void) {
+    return modemCount;
+}
+
+/*!
+
+    \brief  [Private] Compute estimated wait time of a modem
+
+    \param[in]  modem: modem to evaluate
+    \return estimated time before a new SMS would be sent (ms, POOL_NOT_READY if modem can't send)
+
+*/
+uint32_t FF_Sim7000Pool::getCost(FF_Sim7000* modem) {
+    if (modem->needRestart() || !(modem->isIdle() || modem->isSending() || modem->isReceiving())) {
+        return POOL_NOT_READY;
+    }
+    uint32_t pending = modem->getQueueDepth() + 1;                  // Queued SMS (including the one being sent) and this one
+    if (modem->isReceiving()) {
+        pending++;
+    }
+    uint32_t latency = modem->getRecentLatency();
+    return pending * (latency ? latency : POOL_DEFAULT_LATENCY);
+}
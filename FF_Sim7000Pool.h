@@ -0,0 +1,51 @@
+/*!
+    \file
+    \brief  Spreads outbound SMS over multiple FF_Sim7000 modems
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Have a look at FF_Sim7000Pool.cpp for details
+
+*/
+
+#ifndef FF_Sim7000Pool_h
+#define FF_Sim7000Pool_h
+
+#include <Arduino.h>
+#include <FF_Sim7000.h>
+
+#ifndef SIM7000_POOL_SIZE
+    #define SIM7000_POOL_SIZE 4                                     //!< Max count of modems in a pool
+#endif
+
+// Class definition
+class FF_Sim7000Pool {
+public:
+    // public class
+    /*! \class FF_Sim7000Pool
+        \brief Spreads outbound SMS over multiple FF_Sim7000 modems
+
+        Each modem should be started by application (begin() with its own serial), and its restart handled as usual.
+
+        SMS are queued on the modem with the lowest estimated wait time, computed from its queue depth,
+            its idle state and its recent chunk send time.
+
+    */
+    FF_Sim7000Pool();
+
+    // Public routines (documented in FF_Sim7000Pool.cpp)
+    bool add(FF_Sim7000* modem);
+    void doLoop(void);
+    bool sendSMS(const char* number, const char* text);
+    FF_Sim7000* getModem(uint8_t index);
+    uint8_t getCount(void);
+
+private:
+    // Private routines
+    uint32_t getCost(FF_Sim7000* modem);
+
+    // Private variables
+    FF_Sim7000* modems[SIM7000_POOL_SIZE];                          //!< Modems in pool
+    uint8_t modemCount;                                             //!< Count of modems in pool
+};
+#endif
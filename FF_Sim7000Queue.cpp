@@ -0,0 +1,242 @@
+/*!
+    \file
+    \brief  Implements a fixed size record queue used by FF_Sim7000 to store outbound SMS
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Each record is stored as a 2 bytes length followed by data. When a record doesn't fit at end of buffer,
+        a SIM7000_QUEUE_WRAP length is written (if room allows) and record is stored at buffer start.
+
+    Read and write pointers are never equal unless queue is empty, so one byte is always kept free.
+
+    Consumer tests emptiness on push and pop counts, before reading pointers. As it then never uses read pointer
+        while queue is empty, producer may move it back to buffer start when queue is empty and a record doesn't
+        fit at end of buffer, so that whole buffer can be used.
+*/
+
+#include <FF_Sim7000Queue.h>
+
+// Class constructor : init some variables
+FF_Sim7000Queue::FF_Sim7000Queue() {
+    queueBuffer = NULL;
+    queueSize = 0;
+    readPtr = 0;
+    writePtr = 0;
+    pushCount = 0;
+    popCount = 0;
+    highWater = 0;
+    dropCount = 0;
+}
+
+/*!
+
+    \brief  Give storage to queue
+
+    Set buffer to be used to store records. Queue is emptied.
+
+    \param[in]  buffer: storage area (should remain allocated while queue is used)
+    \param[in]  size: storage area size (in bytes)
+    \return none
+
+*/
+void FF_Sim7000Queue::begin(uint8_t* buffer, uint16_t size) {
+    queueBuffer = buffer;
+    queueSize = size;
+    readPtr = 0;
+    writePtr = 0;
+    pushCount = 0;
+    popCount = 0;
+}
+
+/*!
+
+    \brief  Push a record at end of queue
+
+    This routine copies one or two zero terminated strings (with their terminating zero) as one record.
+
+    \param[in]  first: first string to store
+    \param[in]  second: second string to store (or NULL if only one string)
+    \return true if record has been stored, false if queue is full (record is dropped)
+
+*/
+bool FF_Sim7000Queue::push(const char* first, const char* second) {
+    const char* parts[2] = {first, second};
+    return pushParts(parts, second ? 2 : 1);
+}
+
+/*!
+
+    \brief  Push a record made of multiple strings at end of queue
+
+    This routine copies count zero terminated strings (with their terminating zero) as one record.
+
+    \param[in]  parts: strings to store
+    \param[in]  count: count of strings to store
+    \return true if record has been stored, false if queue is full (record is dropped)
+
+*/
+bool FF_Sim7000Queue::pushParts(const char* const parts[], uint8_t count) {
+    size_t needed = SIM7000_QUEUE_HEADER;
+    for (uint8_t i = 0; i < count; i++) {
+        needed += strlen(parts[i]) + 1;
+    }
+    bool isEmpty = pushCount == popCount;
+    __sync_synchronize();                                           // Read pointer after count
+    uint16_t readPos = readPtr;                                     // Take a copy, as consumer may change it
+    uint16_t writePos = writePtr;
+    uint16_t recordPos;
+
+    if (queueBuffer == NULL || needed >= queueSize) {               // Record will never fit
+        dropCount++;
+        return false;
+    }
+    if (isEmpty && writePos && needed >= (size_t) (queueSize - writePos)) {
+        readPtr = 0;                                                // Empty queue, restart at buffer start
+        readPos = 0;
+        writePos = 0;
+    }
+    if (writePos >= readPos) {                                      // Free space is at end and at start of buffer
+        if (needed < (size_t) (queueSize - writePos) || (needed == (size_t) (queueSize - writePos) && readPos)) {
+            recordPos = writePos;                                   // Fits at end of buffer
+        } else if (needed < readPos) {
+            if (queueSize - writePos >= SIM7000_QUEUE_HEADER) {     // Tell consumer to go back to start
+                queueBuffer[writePos] = SIM7000_QUEUE_WRAP & 0xff;
+                queueBuffer[writePos+1] = SIM7000_QUEUE_WRAP >> 8;
+            }
+            recordPos = 0;                                          // Fits at start of buffer
+        } else {
+            dropCount++;
+            return false;
+        }
+    } else {                                                        // Free space is between write and read pointers
+        if (needed < (size_t) (readPos - writePos)) {
+            recordPos = writePos;
+        } else {
+            dropCount++;
+            return false;
+        }
+    }
+    // Write record length and data
+    uint16_t dataLen = needed - SIM7000_QUEUE_HEADER;
+    queueBuffer[recordPos] = dataLen & 0xff;
+    queueBuffer[recordPos+1] = dataLen >> 8;
+    uint8_t* data = queueBuffer + recordPos + SIM7000_QUEUE_HEADER;
+    for (uint8_t i = 0; i < count; i++) {
+        size_t partLen = strlen(parts[i]) + 1;
+        memcpy(data, parts[i], partLen);
+        data += partLen;
+    }
+    writePos = recordPos + needed;
+    if (writePos >= queueSize) {
+        writePos = 0;
+    }
+    __sync_synchronize();                                           // Make data visible before pointer
+    writePtr = writePos;
+    __sync_synchronize();                                           // Make pointers visible before count
+    pushCount++;
+    uint16_t depth = getDepth();
+    if (depth > highWater) {
+        highWater = depth;
+    }
+    return true;
+}
+
+/*!
+
+    \brief  Return oldest record of queue
+
+    Returned record stays in queue until pop() is called, and may be modified in place by consumer.
+
+    \param[out]  length: if not NULL, loaded with record data length
+    \return pointer to first string of record (next ones, if any, are just after previous one's terminating zero), NULL if queue is empty
+
+*/
+char* FF_Sim7000Queue::front(uint16_t* length) {
+    if (queueBuffer == NULL || pushCount == popCount) {
+        return NULL;
+    }
+    __sync_synchronize();                                           // Read pointer after count
+    uint16_t readPos = readPtr;
+    // Go back at buffer start if record doesn't fit at end
+    if (queueSize - readPos < SIM7000_QUEUE_HEADER
+            || (queueBuffer[readPos] | (queueBuffer[readPos+1] << 8)) == SIM7000_QUEUE_WRAP) {
+        readPos = 0;
+        readPtr = 0;
+    }
+    __sync_synchronize();                                           // Read data after pointer
+    if (length) {
+        *length = queueBuffer[readPos] | (queueBuffer[readPos+1] << 8);
+    }
+    return (char*) (queueBuffer + readPos + SIM7000_QUEUE_HEADER);
+}
+
+/*!
+
+    \brief  Remove oldest record from queue
+
+    \param  none
+    \return none
+
+*/
+void FF_Sim7000Queue::pop(void) {
+    uint16_t dataLen;
+    if (front(&dataLen) == NULL) {
+        return;
+    }
+    uint16_t readPos = readPtr + SIM7000_QUEUE_HEADER + dataLen;
+    if (readPos >= queueSize) {
+        readPos = 0;
+    }
+    __sync_synchronize();                                           // Release record before pointer
+    readPtr = readPos;
+    __sync_synchronize();                                           // Make pointer visible before count
+    popCount++;
+}
+
+/*!
+
+    \brief  Checks if queue is empty
+
+    \param  none
+    \return true if queue contains no record
+
+*/
+bool FF_Sim7000Queue::isEmpty(void) {
+    return pushCount == popCount;
+}
+
+/*!
+
+    \brief  Return count of records in queue
+
+    \param  none
+    \return count of records
+
+*/
+uint16_t FF_Sim7000Queue::getDepth(void) {
+    return (uint16_t) (pushCount - popCount);
+}
+
+/*!
+
+    \brief  Return max count of records seen in queue
+
+    \param  none
+    \return high water mark
+
+*/
+uint16_t FF_Sim7000Queue::getHighWater(void) {
+    return highWater;
+}
+
+/*!
+
+    \brief  Return count of records dropped because queue was full
+
+    \param  none
+    \return count of dropped records
+
+*/
+unsigned int FF_Sim7000Queue::getDropCount(void) {
+    return dropCount;
+}
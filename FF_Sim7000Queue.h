@@ -0,0 +1,58 @@
+/*!
+    \file
+    \brief  Implements a fixed size record queue used by FF_Sim7000 to store outbound SMS
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Have a look at FF_Sim7000Queue.cpp for details
+
+*/
+
+#ifndef FF_Sim7000Queue_h
+#define FF_Sim7000Queue_h
+
+#include <Arduino.h>
+
+#define SIM7000_QUEUE_WRAP 0xFFFF                                   //!< Record length marking end of buffer (next record is at buffer start)
+#define SIM7000_QUEUE_HEADER 2                                      //!< Size of record header (record length)
+
+// Class definition
+class FF_Sim7000Queue {
+public:
+    // public class
+    /*! \class FF_Sim7000Queue
+        \brief Implements a fixed size record queue used by FF_Sim7000 to store outbound SMS
+
+        Records are made of one or more zero terminated strings, stored contiguously into a caller supplied buffer.
+
+        As records never wrap around buffer end, the oldest one can be used in place, without copying it.
+
+        Only push() modifies write pointer and only pop() modifies read pointer (except push() on an empty queue),
+            so one producer and one consumer may use it.
+
+    */
+    FF_Sim7000Queue();
+
+    // Public routines (documented in FF_Sim7000Queue.cpp)
+    void begin(uint8_t* buffer, uint16_t size);
+    bool push(const char* first, const char* second = NULL);
+    bool pushParts(const char* const parts[], uint8_t count);
+    char* front(uint16_t* length = NULL);
+    void pop(void);
+    bool isEmpty(void);
+    uint16_t getDepth(void);
+    uint16_t getHighWater(void);
+    unsigned int getDropCount(void);
+
+private:
+    // Private variables
+    uint8_t* queueBuffer;                                           //!< Records storage
+    uint16_t queueSize;                                             //!< Records storage size
+    volatile uint16_t readPtr;                                      //!< Offset of oldest record (only modified by consumer, or producer when empty)
+    volatile uint16_t writePtr;                                     //!< Offset of next record to write (only modified by producer)
+    volatile uint16_t pushCount;                                    //!< Count of records pushed (only modified by producer)
+    volatile uint16_t popCount;                                     //!< Count of records popped (only modified by consumer)
+    uint16_t highWater;                                             //!< Max count of records seen in queue
+    unsigned int dropCount;                                         //!< Count of records rejected (queue full)
+};
+#endif
@@ -0,0 +1,35 @@
+/*!
+    \file
+    \brief  Removes FF_Sim7000 traces above FF_SIM7000_LOG_LEVEL at compile time
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Included by FF_Sim7000 source files only, after FF_Trace.h, so application traces are not changed.
+
+    Removed traces don't generate any code, and their format strings are not stored in flash.
+        Remaining ones are still controlled at run time by debugFlag, traceFlag and FF_Trace levels.
+
+*/
+
+#ifndef FF_Sim7000Trace_h
+#define FF_Sim7000Trace_h
+
+#include <FF_Sim7000.h>
+
+#if FF_SIM7000_LOG_LEVEL < SIM7000_LOG_DEBUG
+    #undef trace_debug_P
+    #define trace_debug_P(...) do {} while (0)
+#endif
+#if FF_SIM7000_LOG_LEVEL < SIM7000_LOG_INFO
+    #undef trace_info_P
+    #define trace_info_P(...) do {} while (0)
+#endif
+#if FF_SIM7000_LOG_LEVEL < SIM7000_LOG_WARN
+    #undef trace_warn_P
+    #define trace_warn_P(...) do {} while (0)
+#endif
+#if FF_SIM7000_LOG_LEVEL < SIM7000_LOG_ERROR
+    #undef trace_error_P
+    #define trace_error_P(...) do {} while (0)
+#endif
+#endif
@@ -0,0 +1,406 @@
+/*!
+    \file
+    \brief  Host benchmark of FF_Sim7000, driven by a modem output transcript
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Runs FF_Sim7000 on a host computer against a simulated modem, which answers to commands and replays a transcript
+        of modem output lines (see transcripts/receive.txt), then sends GSM7 and UCS-2 SMS. Last send test uses
+        answers of a send transcript (see transcripts/send-error.txt) to drive SMS error and retry paths.
+
+    For each phase, it reports throughput (bytes received per second of doLoop() time), heap allocations per message
+        (counted by hooking malloc() and operator new), max doLoop() time and, when sending, time spent in sendSMS()
+        and in doLoop() until SMS is sent.
+
+    A raw capture (received data of FF_SIM7000_CAPTURE records, concatenated, with original line endings, "> " prompts
+        and PDUs) can be given with -r: it's analyzed through replay(), as on modem, after transcript. When bench is
+        built with FF_SIM7000_CAPTURE (make CAPTURE=1), -w writes such a capture of transcript phase last received data.
+
+    Usage: bench [-n transcript repeat count] [-m messages per send test] [-c bytes received per ms]
+        [-s send transcript file] [-r raw capture to replay] [-w raw capture to write] [transcript file]
+
+    Simulated time goes 1 ms per doLoop() call. Default -c 12 is about 115200 bds.
+*/
+
+#include <Arduino.h>
+#include <FF_Sim7000.h>
+#include <chrono>
+#include <new>
+#include <vector>
+#include <unistd.h>
+
+#define BENCH_MAX_WAIT 120000                                       // Max simulated time to wait for a phase to complete (ms)
+
+// Heap allocations counters (all allocations of process, read before and after each phase)
+static unsigned long heapAllocs = 0;
+static unsigned long heapFrees = 0;
+
+#ifdef __GLIBC__
+    // Hook C allocator (operator new of libstdc++ uses malloc(), so it's counted too)
+    extern "C" {
+        void* __libc_malloc(size_t size);
+        void* __libc_calloc(size_t count, size_t size);
+        void* __libc_realloc(void* pointer, size_t size);
+        void __libc_free(void* pointer);
+
+        void* malloc(size_t size) {
+            heapAllocs++;
+            return __libc_malloc(size);
+        }
+        void* calloc(size_t count, size_t size) {
+            heapAllocs++;
+            return __libc_calloc(count, size);
+        }
+        void* realloc(void* pointer, size_t size) {
+            heapAllocs++;
+            if (pointer) heapFrees++;
+            return __libc_realloc(pointer, size);
+        }
+        void free(void* pointer) {
+            if (pointer) heapFrees++;
+            __libc_free(pointer);
+        }
+    }
+#else
+    // Only C++ allocations are counted
+    void* operator new(size_t size) {
+        heapAllocs++;
+        void* pointer = malloc(size ? size : 1);
+        if (!pointer) throw std::bad_alloc();
+        return pointer;
+    }
+    void* operator new[](size_t size) {return operator new(size);}
+    void operator delete(void* pointer) noexcept {
+        if (pointer) heapFrees++;
+        free(pointer);
+    }
+    void operator delete[](void* pointer) noexcept {operator delete(pointer);}
+    void operator delete(void* pointer, size_t) noexcept {operator delete(pointer);}
+    void operator delete[](void* pointer, size_t) noexcept {operator delete(pointer);}
+#endif
+
+//! Simulated modem, answering to commands written by FF_Sim7000
+class BenchModem {
+public:
+    BenchModem(HardwareSerial& serial) : port(serial) {}
+
+    // Add modem output
+    void send(const std::string& data) {
+        port.rx.append(data);
+    }
+
+    // Set answers given to sent chunks, in turn (default answer is used if empty)
+    void setChunkAnswers(const std::vector<std::string>& answers) {
+        chunkAnswers = answers;
+        nextAnswer = 0;
+    }
+
+    // Answer to commands written since last call
+    void step(void) {
+        pending.append(port.tx);
+        port.tx.clear();
+        size_t pos;
+        while ((pos = pending.find_first_of("\r\x1a")) != std::string::npos) {
+            std::string command = pending.substr(0, pos);
+            bool isEof = pending[pos] == 0x1a;
+            pending.erase(0, pos + 1);
+            while (!command.empty() && command[0] == 0x1b) {        // ESC cancelling a pending SMS
+                command.erase(0, 1);
+            }
+            if (isEof && !chunkAnswers.empty()) {
+                send(chunkAnswers[nextAnswer]);
+                nextAnswer = (nextAnswer + 1) % chunkAnswers.size();
+            } else if (isEof) {
+                send("\r\n+CMGS: " + std::to_string(++messageRef & 0xFF) + "\r\n\r\nOK\r\n");
+            } else if (command.compare(0, 8, "AT+CMGS=") == 0) {
+                send("\r\n> ");
+            } else if (command.find("+CSCA?") != std::string::npos) {
+                send("\r\n+CSCA: \"+33609001390\",145\r\n\r\nOK\r\n");
+            } else if (command.compare(0, 2, "AT") == 0) {
+                send("\r\nOK\r\n");
+            }
+        }
+    }
+
+private:
+    HardwareSerial& port;
+    std::string pending;
+    int messageRef = 0;
+    std::vector<std::string> chunkAnswers;
+    size_t nextAnswer = 0;
+};
+
+FF_Sim7000 modem;
+BenchModem sim(Serial1);
+unsigned long receivedCount = 0;
+unsigned long sentCount = 0;
+unsigned long bytesPerMs = 12;
+
+void onSmsReceived(const char*, const char*, const char*) {
+    receivedCount++;
+}
+
+void onSmsSent(const char*, const char*, const char*) {
+    sentCount++;
+}
+
+// Returns host time (us)
+static double nowUs(void) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Run modem for one simulated ms
+static void step(void) {
+    if (Serial1.rxLimit < Serial1.rx.size()) {
+        Serial1.rxLimit += bytesPerMs;
+    }
+    modem.doLoop();
+    sim.step();
+    hostMillis++;
+}
+
+// Run modem until condition is true or BENCH_MAX_WAIT simulated ms elapsed, returning condition
+template <typename T> static bool runUntil(T condition) {
+    unsigned long start = hostMillis;
+    while (!condition()) {
+        if (hostMillis - start > BENCH_MAX_WAIT) return false;
+        step();
+    }
+    return true;
+}
+
+// Load transcript file, returning modem output blocks (separated by "---" lines; empty if file can't be read)
+static std::vector<std::string> loadTranscript(const char* fileName) {
+    std::vector<std::string> blocks;
+    FILE* file = fopen(fileName, "r");
+    if (!file) return blocks;
+    blocks.push_back("");
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        size_t len = strcspn(line, "\r\n");
+        if (line[0] == '#') continue;
+        if (len == 3 && !memcmp(line, "---", 3)) {
+            blocks.push_back("");
+            continue;
+        }
+        blocks.back().append(line, len);
+        blocks.back().append("\r\n");
+    }
+    fclose(file);
+    if (blocks.back().empty()) blocks.pop_back();
+    return blocks;
+}
+
+// Load raw capture file (empty if file can't be read)
+static std::string loadCapture(const char* fileName) {
+    std::string data;
+    FILE* file = fopen(fileName, "rb");
+    if (!file) return data;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.append(buffer, length);
+    }
+    fclose(file);
+    return data;
+}
+
+#ifdef FF_SIM7000_CAPTURE
+    static FILE* captureFile = NULL;
+
+    // Write received data of a capture record to capture file
+    void onCaptureRecord(unsigned long, bool sent, const char* data, size_t length) {
+        if (!sent) fwrite(data, 1, length, captureFile);
+    }
+
+    // Write received data of capture ring to a raw capture file
+    static bool writeCapture(const char* fileName) {
+        captureFile = fopen(fileName, "wb");
+        if (!captureFile) return false;
+        modem.registerCaptureCb(onCaptureRecord);
+        modem.dumpCapture();
+        modem.registerCaptureCb(NULL);
+        fclose(captureFile);
+        captureFile = NULL;
+        return true;
+    }
+#endif
+
+// Heap counters at phase start
+static unsigned long phaseAllocs;
+static unsigned long phaseFrees;
+
+// Start a phase
+static void startPhase(void) {
+    modem.resetMetrics();
+    phaseAllocs = heapAllocs;
+    phaseFrees = heapFrees;
+}
+
+// Print common metrics of a phase (heap counters are read first, as printing may allocate)
+static void printMetrics(unsigned long messages) {
+    unsigned long allocs = heapAllocs - phaseAllocs;
+    unsigned long frees = heapFrees - phaseFrees;
+    const FF_Sim7000Metrics& metrics = modem.getMetrics();
+    printf("  doLoop(): %u calls, %.1f us average, %u us max\n", metrics.loopCount,
+        metrics.loopCount ? (double) metrics.loopTotalUs / metrics.loopCount : 0.0, metrics.loopMaxUs);
+    printf("  Heap: %.2f allocations, %.2f frees per message (%lu/%lu total)\n",
+        messages ? (double) allocs / messages : 0.0, messages ? (double) frees / messages : 0.0, allocs, frees);
+}
+
+// Replay transcript repeat times
+static bool benchReceive(const std::string& transcript, int repeat, const char* fileName) {
+    printf("Receive: %d x %s (%u bytes)\n", repeat, fileName, (unsigned) transcript.size());
+    std::string data;
+    for (int i = 0; i < repeat; i++) {
+        data.append(transcript);
+    }
+    receivedCount = 0;
+    Serial1.rxLimit = Serial1.rxPos;
+    sim.send(data);
+    startPhase();
+    double start = nowUs();
+    bool ok = runUntil([]() {return !Serial1.available() && Serial1.rxLimit >= Serial1.rx.size() && modem.isIdle();});
+    double wallUs = nowUs() - start;
+    Serial1.rxLimit = (size_t) -1;
+    const FF_Sim7000Metrics& metrics = modem.getMetrics();
+    printMetrics(receivedCount);
+    printf("  %u bytes, %u lines, %lu SMS received%s\n", metrics.rxBytes, metrics.rxLines, receivedCount, ok ? "" : " (timed out)");
+    printf("  Throughput: %.0f bytes/s of doLoop() time, %.0f bytes/s of wall time\n",
+        metrics.loopTotalUs ? metrics.rxBytes * 1e6 / metrics.loopTotalUs : 0.0, wallUs > 0 ? metrics.rxBytes * 1e6 / wallUs : 0.0);
+    return ok;
+}
+
+// Analyze a raw capture through replay()
+static bool benchReplay(const std::string& capture, const char* fileName) {
+    printf("Replay: %s (%u bytes)\n", fileName, (unsigned) capture.size());
+    receivedCount = 0;
+    startPhase();
+    double start = nowUs();
+    modem.replay(capture.data(), capture.size());
+    double wallUs = nowUs() - start;
+    Serial1.tx.clear();                                             // Commands triggered by capture are answered in it
+    const FF_Sim7000Metrics& metrics = modem.getMetrics();
+    printMetrics(receivedCount);
+    printf("  %u bytes, %u lines, %lu SMS received\n", metrics.rxBytes, metrics.rxLines, receivedCount);
+    printf("  Throughput: %.0f bytes/s of doLoop() time, %.0f bytes/s of wall time\n",
+        metrics.loopTotalUs ? metrics.rxBytes * 1e6 / metrics.loopTotalUs : 0.0, wallUs > 0 ? metrics.rxBytes * 1e6 / wallUs : 0.0);
+    // Let modem complete (or time out) commands waiting for an answer
+    return runUntil([]() {return modem.isIdle();});
+}
+
+// Send count times the same message
+static bool benchSend(const char* title, const char* text, int count) {
+    FF_Sim7000MessagePlan plan;
+    modem.planMessage(text, &plan);
+    printf("Send %s: %d x %u %s characters, %u chunk(s)\n", title, count, plan.length, plan.isGsm7 ? "GSM7" : "UCS-2",
+        plan.chunkCount ? plan.chunkCount : 1);
+    unsigned long firstSent = sentCount;
+    double sendTotal = 0, sendMax = 0;
+    startPhase();
+    for (int i = 0; i < count; i++) {
+        double start = nowUs();
+        bool queued = modem.sendSMS("+33612345678", text);
+        double duration = nowUs() - start;
+        sendTotal += duration;
+        if (duration > sendMax) sendMax = duration;
+        // Wait for message to be sent (or dropped after errors)
+        if (!queued || !runUntil([]() {return !modem.getQueueDepth() && modem.isIdle();})) {
+            printMetrics(i);
+            printf("  Message %d not sent!\n", i + 1);
+            return false;
+        }
+    }
+    printMetrics(count);
+    const FF_Sim7000Metrics& metrics = modem.getMetrics();
+    printf("  sendSMS(): %.2f us average, %.2f us max\n", sendTotal / count, sendMax);
+    printf("  Until sent: %.1f us of doLoop() time per message\n", (double) metrics.loopTotalUs / count);
+    if (metrics.smsRetryCount || metrics.smsFailCount || sentCount - firstSent != (unsigned long) count) {
+        printf("  %lu sent, %u chunk retries, %u dropped\n", sentCount - firstSent, metrics.smsRetryCount, metrics.smsFailCount);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int repeat = 100;
+    int messages = 50;
+    int option;
+    const char* sendFileName = "transcripts/send-error.txt";
+    const char* replayFileName = NULL;
+    const char* writeFileName = NULL;
+    while ((option = getopt(argc, argv, "n:m:c:s:r:w:")) != -1) {
+        switch (option) {
+            case 'n': repeat = atoi(optarg); break;
+            case 'm': messages = atoi(optarg); break;
+            case 'c': bytesPerMs = strtoul(optarg, NULL, 10); break;
+            case 's': sendFileName = optarg; break;
+            case 'r': replayFileName = optarg; break;
+            case 'w': writeFileName = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n repeat] [-m messages] [-c bytes per ms] [-s send transcript] [-r raw capture]"
+                    " [-w raw capture] [transcript]\n", argv[0]);
+                return 2;
+        }
+    }
+    const char* fileName = optind < argc ? argv[optind] : "transcripts/receive.txt";
+    std::vector<std::string> blocks = loadTranscript(fileName);
+    std::vector<std::string> chunkAnswers = loadTranscript(sendFileName);
+    if (blocks.empty() || chunkAnswers.empty()) {
+        fprintf(stderr, "Can't read %s\n", blocks.empty() ? fileName : sendFileName);
+        return 2;
+    }
+    std::string transcript;
+    for (auto& block : blocks) {
+        transcript.append(block);
+    }
+    std::string capture;
+    if (replayFileName && (capture = loadCapture(replayFileName)).empty()) {
+        fprintf(stderr, "Can't read %s\n", replayFileName);
+        return 2;
+    }
+    #ifndef FF_SIM7000_CAPTURE
+        if (writeFileName) {
+            fprintf(stderr, "Capture is not enabled (build with make CAPTURE=1)\n");
+            return 2;
+        }
+    #endif
+    if (repeat < 1) repeat = 1;
+    if (messages < 1) messages = 1;
+    if (!bytesPerMs) bytesPerMs = 1;
+
+    #ifdef BENCH_PDU_STUB
+        printf("Warning: PDUlib not found, messages are not really encoded/decoded (see Makefile PDULIB_DIR)\n");
+    #endif
+    modem.registerSmsCb(onSmsReceived);
+    modem.registerSendCb(onSmsSent);
+    modem.begin(Serial1, 115200, -1, -1);
+    if (!runUntil([]() {return modem.isIdle();})) {
+        printf("Modem init failed!\n");
+        return 1;
+    }
+    printf("Init: %lu ms (simulated)\n", hostMillis);
+
+    std::string longGsm7, longUcs2;
+    for (int i = 0; i < 5; i++) {
+        longGsm7 += "The quick brown fox jumps over the lazy dog, again and again. ";
+        longUcs2 += "Température élevée : 42°C dans la pièce n°3 ! ";
+    }
+    bool ok = benchReceive(transcript, repeat, fileName);
+    #ifdef FF_SIM7000_CAPTURE
+        if (writeFileName && !writeCapture(writeFileName)) {
+            fprintf(stderr, "Can't write %s\n", writeFileName);
+            ok = false;
+        }
+    #endif
+    if (replayFileName) {
+        ok = benchReplay(capture, replayFileName) && ok;
+    }
+    ok = benchSend("GSM7 single", "Hello world, this is a short GSM7 message", messages) && ok;
+    ok = benchSend("GSM7 multi-part", longGsm7.c_str(), messages) && ok;
+    ok = benchSend("UCS-2 single", "Température : 21°C", messages) && ok;
+    ok = benchSend("UCS-2 multi-part", longUcs2.c_str(), messages) && ok;
+    sim.setChunkAnswers(chunkAnswers);
+    printf("Answers to sent chunks from %s (%u blocks)\n", sendFileName, (unsigned) chunkAnswers.size());
+    ok = benchSend("GSM7 multi-part with errors", longGsm7.c_str(), messages) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+/*!
+    \file
+    \brief  Minimal Arduino API used to build FF_Sim7000 on a host computer (benchmark only)
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Have a look at Arduino.h for details
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+unsigned long hostMillis = 0;
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+
+unsigned long millis(void) {
+    return hostMillis;
+}
+
+unsigned long micros(void) {
+    return (unsigned long) std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Waits are simulated, making time go on
+void delay(unsigned long ms) {
+    hostMillis += ms;
+}
+
+void yield(void) {}
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) {return LOW;}
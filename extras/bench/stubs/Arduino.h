@@ -0,0 +1,125 @@
+/*!
+    \file
+    \brief  Minimal Arduino API used to build FF_Sim7000 on a host computer (benchmark only)
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    millis() returns a simulated time, advanced by benchmark, so that modem time-outs don't depend on host speed.
+        micros() returns real host time, so that doLoop() metrics measure real CPU time.
+
+    Serial ports don't talk to any hardware: data written by FF_Sim7000 is stored in tx, and data read comes
+        from rx, filled by benchmark simulated modem.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define OUTPUT_OPEN_DRAIN 2
+#define SERIAL_8N1 0
+
+// Flash strings are plain strings on host
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+extern unsigned long hostMillis;                                    //!< Simulated time returned by millis() (ms)
+
+//! String class (only what FF_Sim7000 uses)
+class String {
+public:
+    String() {}
+    String(const char* str) : value(str ? str : "") {}
+    String& operator=(const char* str) {value = str ? str : ""; return *this;}
+    const char* c_str(void) const {return value.c_str();}
+    unsigned int length(void) const {return (unsigned int) value.size();}
+
+private:
+    std::string value;
+};
+
+//! Print class (only what FF_Sim7000 uses)
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        for (size_t i = 0; i < size; i++) write(buffer[i]);
+        return size;
+    }
+    size_t write(const char* str) {return write((const uint8_t*) str, strlen(str));}
+    size_t write(const char* buffer, size_t size) {return write((const uint8_t*) buffer, size);}
+    size_t print(const char* str) {return write(str);}
+    size_t print(char c) {return write((uint8_t) c);}
+    size_t println(const char* str) {return write(str) + write("\r\n");}
+};
+
+//! Stream class (only what FF_Sim7000 uses)
+class Stream : public Print {
+public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        while (count < length && available()) buffer[count++] = (char) read();
+        return count;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) {return readBytes((char*) buffer, length);}
+    void setTimeout(unsigned long) {}
+};
+
+//! Serial port, exchanging data with benchmark simulated modem
+class HardwareSerial : public Stream {
+public:
+    std::string rx;                                                 //!< Data to be read by FF_Sim7000
+    size_t rxPos = 0;                                               //!< Next rx position to read
+    size_t rxLimit = (size_t) -1;                                   //!< Max rx position readable (simulates UART FIFO filling)
+    std::string tx;                                                 //!< Data written by FF_Sim7000
+    unsigned long baudRate = 0;                                     //!< Last speed given to begin()
+
+    int available(void) override {
+        size_t end = rx.size() < rxLimit ? rx.size() : rxLimit;
+        return rxPos < end ? (int) (end - rxPos) : 0;
+    }
+    int read(void) override {return available() ? (uint8_t) rx[rxPos++] : -1;}
+    size_t write(uint8_t c) override {tx += (char) c; return 1;}
+    size_t write(const uint8_t* buffer, size_t size) override {tx.append((const char*) buffer, size); return size;}
+    using Print::write;
+    void begin(unsigned long baud, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1) {baudRate = baud;}
+    void end(void) {}
+    void flush(void) {}
+    void setDebugOutput(bool) {}
+    void swap(void) {}
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+#endif
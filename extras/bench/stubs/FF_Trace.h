@@ -0,0 +1,39 @@
+/*!
+    \file
+    \brief  FF_Trace replacement used to build FF_Sim7000 on a host computer (benchmark only)
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Traces would change measured times, so they're removed unless BENCH_TRACE is defined.
+*/
+
+#ifndef FF_Trace_h
+#define FF_Trace_h
+
+#include <stdio.h>
+#include <stdarg.h>
+
+// Print a trace on stderr (not format checked, as FF_Trace, traces giving NULL as only argument)
+inline void benchTrace(const char* level, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    fputs(level, stderr);
+    vfprintf(stderr, format, arguments);
+    fputc('\n', stderr);
+    va_end(arguments);
+}
+
+#ifdef BENCH_TRACE
+    #define trace_debug_P(...) benchTrace("D: ", __VA_ARGS__)
+    #define trace_info_P(...) benchTrace("I: ", __VA_ARGS__)
+    #define trace_warn_P(...) benchTrace("W: ", __VA_ARGS__)
+    #define trace_error_P(...) benchTrace("E: ", __VA_ARGS__)
+#else
+    // Arguments are still compiled (so that they're not unused), but never evaluated
+    #define trace_debug_P(...) do {if (0) benchTrace("", __VA_ARGS__);} while (0)
+    #define trace_info_P(...) do {if (0) benchTrace("", __VA_ARGS__);} while (0)
+    #define trace_warn_P(...) do {if (0) benchTrace("", __VA_ARGS__);} while (0)
+    #define trace_error_P(...) do {if (0) benchTrace("", __VA_ARGS__);} while (0)
+#endif
+
+#endif
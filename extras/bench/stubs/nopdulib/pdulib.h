@@ -0,0 +1,53 @@
+/*!
+    \file
+    \brief  PDU class replacement, used by benchmark when PDUlib sources are not found (see Makefile PDULIB_DIR)
+    \author Flying Domotic
+    \date   March 31st, 2025
+
+    Messages are not really encoded nor decoded: encodePDU() gives text as hexadecimal, decodePDU() gives PDU as text.
+        Measured times then only reflect FF_Sim7000 itself, and multi-part received SMS are not reassembled.
+*/
+
+#ifndef pdulib_h
+#define pdulib_h
+
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_PDU_STUB                                              //!< Tells benchmark that PDU class is not the real one
+
+class PDU {
+public:
+    PDU(int size = 100) : bufferSize(size) {
+        buffer = new char[size];
+        buffer[0] = 0;
+        concatInfo[0] = concatInfo[1] = concatInfo[2] = 0;
+    }
+    ~PDU() {delete[] buffer;}
+    int encodePDU(const char* recipient, const char* message, unsigned short = 0, unsigned char = 0, unsigned char = 0) {
+        int length = 0;
+        int pos = snprintf(buffer, bufferSize, "0011000B91%s", recipient[0] == '+' ? recipient + 1 : recipient);
+        for (const char* c = message; *c && pos + 3 < bufferSize; c++, length++) {
+            pos += snprintf(buffer + pos, bufferSize - pos, "%02X", (unsigned char) *c);
+        }
+        return length + 8;
+    }
+    const char* getSMS(void) {return buffer;}
+    bool decodePDU(const char* pdu) {
+        snprintf(buffer, bufferSize, "%s", pdu);
+        return true;
+    }
+    const char* getSender(void) {return "+33612345678";}
+    const char* getTimeStamp(void) {return "25/04/02 09:49:27";}
+    const char* getText(void) {return buffer;}
+    bool getOverflow(void) {return false;}
+    int* getConcatInfo(void) {return concatInfo;}
+    void setSCAnumber(const char*) {}
+
+private:
+    char* buffer;
+    int bufferSize;
+    int concatInfo[3];
+};
+
+#endif
@@ -6,12 +6,7 @@
 #define MOS_PER_YEAR        12
 #define EPOCH_YEAR          1970
 #define IS_LEAP_YEAR(year)  ( (((year)%4 == 0) && ((year)%100 != 0)) || ((year)%400 == 0) )
-
-static int days_per_month[2][MOS_PER_YEAR] = {
-  { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 },
-  { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 }
-};
-
-static int days_per_year[2] = {365, 366};
+#define DAYS_PER_ERA        146097                                  // Days in 400 years
+#define EPOCH_DAYS          719468                                  // Days from 0000-03-01 to 1970-01-01
 
 uint32_t unixTimeInSeconds(uint8_t sec, uint8_t min, uint8_t hrs, uint8_t day, uint8_t mon, uint16_t year );